@@ -0,0 +1,256 @@
+#include "accesslog.hpp"
+
+#include <plog/Log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+
+using std::string, std::string_view;
+
+// must be a power of two
+constexpr size_t RING_SIZE = 4096;
+// the file is rotated once it gets this big, and this many old ones are kept
+// around (as access.log.1, access.log.2...)
+constexpr size_t MAX_FILE_SIZE = 16 * 1024 * 1024;
+constexpr int KEPT_FILES = 4;
+constexpr size_t MAX_BATCH_SIZE = 64 * 1024;
+constexpr auto IDLE_WAIT = std::chrono::milliseconds(50);
+
+// Record
+
+template <size_t N>
+static void copy_truncated(char (&dst)[N], uint8_t &len, string_view src) {
+    static_assert(N <= UINT8_MAX);
+    len = (uint8_t)std::min(src.size(), N);
+    std::copy_n(src.data(), len, dst);
+}
+
+void AccessLog::Record::set_method(string_view method) {
+    copy_truncated(this->method, method_len, method);
+}
+
+void AccessLog::Record::set_route(string_view route) {
+    copy_truncated(this->route, route_len, route);
+}
+
+void AccessLog::Record::set_uri(string_view uri) {
+    copy_truncated(this->uri, uri_len, uri);
+}
+
+void AccessLog::Record::set_body(string_view body) {
+    copy_truncated(this->body, body_len, body);
+}
+
+// AccessLog
+
+AccessLog::AccessLog(const string &filename, AccessLogFormat format)
+    : m_slots{std::make_unique<Slot[]>(RING_SIZE)}, m_mask{RING_SIZE - 1},
+      m_filename{filename}, m_format{format} {
+    static_assert((RING_SIZE & (RING_SIZE - 1)) == 0);
+    for(size_t i = 0; i < RING_SIZE; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    open_file();
+    if(nullptr == m_file) {
+        PLOG_FATAL << "could not open the access log " << m_filename;
+        exit(1);
+    }
+    m_writer = std::thread(&AccessLog::writer_loop, this);
+}
+
+AccessLog::~AccessLog() {
+    m_stopping = true;
+    if(m_writer.joinable()) {
+        m_writer.join();
+    }
+    if(nullptr != m_file) {
+        std::fclose(m_file);
+    }
+}
+
+// a bounded multi-producer queue: a slot whose sequence equals the producer's
+// position is free, and one whose sequence is a position past it holds a
+// record that the writer hasn't taken yet.
+bool AccessLog::push(const Record &record) {
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    while(true) {
+        Slot &slot = m_slots[pos & m_mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if(diff == 0) {
+            if(m_head.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed))
+            {
+                slot.record = record;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if(diff < 0) {
+            // the writer hasn't gotten to this slot since the last time
+            // around, so the ring is full
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool AccessLog::pop(Record &record) {
+    Slot &slot = m_slots[m_tail & m_mask];
+    if(slot.sequence.load(std::memory_order_acquire) != m_tail + 1) {
+        return false;
+    }
+    record = slot.record;
+    slot.sequence.store(m_tail + RING_SIZE, std::memory_order_release);
+    m_tail++;
+    return true;
+}
+
+static void encode_record(const AccessLog::Record &record, string &out) {
+    BinaryRecordHeader header{};
+    header.status_code = (uint16_t)record.status_code;
+    header.is_ip6 = record.peer.is_ip6;
+    header.method_len = record.method_len;
+    header.timestamp = record.timestamp;
+    header.latency_micros = record.latency_micros;
+    header.response_size = record.response_size;
+    header.port = record.peer.port;
+    header.route_len = record.route_len;
+    header.uri_len = record.uri_len;
+    std::copy(std::begin(record.peer.ip), std::end(record.peer.ip),
+              header.ip);
+    header.body_len = record.body_len;
+    header.size = binary_record_size(header);
+
+    size_t start = out.size();
+    out.append((const char *)&header, sizeof(header));
+    out.append(record.method, record.method_len);
+    out.append(record.route, record.route_len);
+    out.append(record.uri, record.uri_len);
+    out.append(record.body, record.body_len);
+    out.resize(start + header.size, '\0');
+}
+
+static void format_record(const AccessLog::Record &record, string &out) {
+    char buf[128]{};
+
+    time_t seconds = record.timestamp / 1000;
+    std::tm tm{};
+    gmtime_r(&seconds, &tm);
+    size_t len = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    out.append(buf, len);
+    len = mg_snprintf(buf, sizeof(buf), ".%03dZ %M ",
+                      (int)(record.timestamp % 1000), mg_print_ip_port,
+                      &record.peer);
+    out.append(buf, len);
+
+    out.append(record.method, record.method_len);
+    len = mg_snprintf(buf, sizeof(buf), " %d %u %lld.%03lldms ",
+                      record.status_code, record.response_size,
+                      (long long)(record.latency_micros / 1000),
+                      (long long)(record.latency_micros % 1000));
+    out.append(buf, len);
+    out.append(record.uri, record.uri_len);
+
+    if(record.body_len > 0) {
+        out += ' ';
+        size_t start = out.size();
+        out.append(record.body, record.body_len);
+        std::replace(out.begin() + start, out.end(), '\n', ' ');
+    }
+    out += '\n';
+}
+
+void AccessLog::writer_loop() {
+    string batch{};
+    batch.reserve(MAX_BATCH_SIZE + 512);
+    Record record{};
+    uint64_t reported_dropped = 0;
+
+    while(true) {
+        // checked before draining, so that everything pushed before the stop
+        // still makes it out
+        bool stopping = m_stopping.load();
+        while(batch.size() < MAX_BATCH_SIZE && pop(record)) {
+            if(m_format == AccessLogFormat::Binary) {
+                encode_record(record, batch);
+            } else {
+                format_record(record, batch);
+            }
+        }
+
+        uint64_t dropped = get_dropped();
+        if(dropped != reported_dropped) {
+            PLOG_WARNING << "access log: dropped " << dropped - reported_dropped
+                         << " records";
+            reported_dropped = dropped;
+        }
+
+        if(!batch.empty()) {
+            write(batch);
+            batch.clear();
+            continue;
+        }
+        if(stopping) {
+            return;
+        }
+        std::this_thread::sleep_for(IDLE_WAIT);
+    }
+}
+
+void AccessLog::open_file() {
+    m_file = std::fopen(m_filename.c_str(), "a");
+    if(nullptr == m_file) {
+        m_file_size = 0;
+        return;
+    }
+    std::fseek(m_file, 0, SEEK_END);
+    long size = std::ftell(m_file);
+    m_file_size = size > 0 ? (size_t)size : 0;
+
+    if(m_format == AccessLogFormat::Binary && m_file_size == 0) {
+        std::fwrite(ACCESS_LOG_MAGIC, 1, sizeof(ACCESS_LOG_MAGIC), m_file);
+        m_file_size = sizeof(ACCESS_LOG_MAGIC);
+    }
+}
+
+void AccessLog::rotate() {
+    std::fclose(m_file);
+
+    // errors are ignored, since most of these files won't exist yet
+    std::error_code ec{};
+    for(int i = KEPT_FILES - 1; i > 0; i--) {
+        std::filesystem::rename(m_filename + '.' + std::to_string(i),
+                                m_filename + '.' + std::to_string(i + 1), ec);
+    }
+    std::filesystem::rename(m_filename, m_filename + ".1", ec);
+
+    open_file();
+    if(nullptr == m_file) {
+        PLOG_ERROR << "could not reopen the access log " << m_filename;
+    }
+}
+
+void AccessLog::write(const string &batch) {
+    if(nullptr != m_file && m_file_size >= MAX_FILE_SIZE) {
+        rotate();
+    }
+    if(nullptr == m_file) {
+        // try again every time, in case whatever was wrong got fixed
+        open_file();
+        if(nullptr == m_file) {
+            return;
+        }
+    }
+
+    if(std::fwrite(batch.data(), 1, batch.size(), m_file) != batch.size()) {
+        PLOG_ERROR << "could not write to the access log";
+    }
+    std::fflush(m_file);
+    m_file_size += batch.size();
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "accesslog_format.hpp"
+
+#include <mongoose/mongoose.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/// Writes one line per handled request to a file of its own, off of the event
+/// loops. Requests only copy a fixed-size record into a lock-free ring, and a
+/// background thread formats the records and writes them out in batches.
+///
+/// Records are written either as text or in the binary format described in
+/// accesslog_format.hpp, which is cheaper to write and to go through later.
+///
+/// If the writer falls behind and the ring fills up, new records are dropped
+/// (and counted) rather than making the event loops wait.
+class AccessLog {
+  public:
+    struct Record {
+        // milliseconds since the epoch
+        int64_t timestamp{};
+        // from the moment the request was parsed until the response was queued
+        int64_t latency_micros{};
+        mg_addr peer{};
+        int status_code{};
+        uint32_t response_size{};
+        uint8_t method_len{};
+        uint8_t route_len{};
+        uint8_t uri_len{};
+        uint8_t body_len{};
+        char method[8];
+        // the route that handled the request, if any
+        char route[48];
+        char uri[160];
+        // the beginning of the request body, unless it's confidential
+        char body[40];
+
+        void set_method(std::string_view method);
+        void set_route(std::string_view route);
+        void set_uri(std::string_view uri);
+        void set_body(std::string_view body);
+    };
+
+  private:
+    struct Slot {
+        // tells producers and the consumer whose turn it is on this slot
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head{0};
+    // only touched by the writer thread
+    alignas(64) size_t m_tail{0};
+    std::atomic<uint64_t> m_dropped{0};
+
+    std::string m_filename;
+    AccessLogFormat m_format;
+    std::FILE *m_file{nullptr};
+    size_t m_file_size{0};
+    std::atomic<bool> m_stopping{false};
+    std::thread m_writer{};
+
+    bool pop(Record &record);
+    void writer_loop();
+    void open_file();
+    void rotate();
+    void write(const std::string &batch);
+
+  public:
+    AccessLog() = delete;
+    AccessLog(const AccessLog &) = delete;
+    AccessLog(AccessLog &&) = delete;
+    /// Exits if the file can't be opened.
+    AccessLog(const std::string &filename, AccessLogFormat format);
+    /// Writes out whatever is still queued.
+    ~AccessLog();
+
+    /// Never blocks. Returns false if the record had to be dropped.
+    bool push(const Record &record);
+
+    inline uint64_t get_dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+};
\ No newline at end of file
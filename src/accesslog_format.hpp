@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+// This is shared by the server and by the tools that read its access logs, so
+// it must not depend on anything else.
+
+enum class AccessLogFormat {
+    // one human-readable line per request
+    Text,
+    // length-prefixed records, described below
+    Binary,
+};
+
+/// Every binary access log starts with these 8 bytes.
+inline constexpr char ACCESS_LOG_MAGIC[8] = {'A', 'N', 'D', 'R',
+                                             'L', 'O', 'G', '1'};
+
+/// A binary record starts with this header, which is followed by the method,
+/// the route, the URI and the start of the body (unterminated, with the
+/// lengths given in the header), and then by zero padding up to a multiple of
+/// 8 bytes. Records are written in the byte order of the machine that writes
+/// them.
+///
+/// Since every record starts on an 8-byte boundary, a reader that maps the
+/// whole file can look at the headers in place.
+struct BinaryRecordHeader {
+    // of the whole record, padding included
+    uint32_t size;
+    uint16_t status_code;
+    uint8_t is_ip6;
+    uint8_t method_len;
+    // milliseconds since the epoch
+    int64_t timestamp;
+    int64_t latency_micros;
+    uint32_t response_size;
+    // in network byte order, same as mg_addr
+    uint16_t port;
+    uint8_t route_len;
+    uint8_t uri_len;
+    uint8_t ip[16];
+    uint8_t body_len;
+    uint8_t reserved[7];
+};
+
+static_assert(sizeof(BinaryRecordHeader) == 56);
+static_assert(sizeof(BinaryRecordHeader) % 8 == 0);
+
+inline constexpr uint32_t binary_record_size(const BinaryRecordHeader &header) {
+    uint32_t size = sizeof(BinaryRecordHeader) + header.method_len +
+                    header.route_len + header.uri_len + header.body_len;
+    return (size + 7) & ~(uint32_t)7;
+}
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include "asyncdb.hpp"
+
+#include <plog/Log.h>
+
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+using std::string, std::monostate, std::vector;
+
+// a write waits this long for others to join it in a transaction
+constexpr auto BATCH_WINDOW = std::chrono::milliseconds(2);
+// and no more than this many share one
+constexpr size_t MAX_BATCH = 64;
+
+AsyncDatabase::AsyncDatabase(const Database &db)
+    : m_db{db}, m_thread{&AsyncDatabase::writer_loop, this} {
+}
+
+AsyncDatabase::~AsyncDatabase() {
+    shutdown();
+}
+
+void AsyncDatabase::shutdown() {
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_stopping) {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+    PLOG_INFO << "database thread stopped after committing " << m_writes
+              << " writes in " << m_batches << " transactions";
+}
+
+template <typename T, typename Op>
+void AsyncDatabase::submit(Op op,
+                           std::function<void(const DbResult<T> &)> done) {
+    auto result = std::make_shared<std::optional<DbResult<T>>>();
+    Write write{.run =
+                    [this, op = std::move(op), result] {
+                        result->emplace(op(m_db));
+                        return (*result)->is_ok();
+                    },
+                .complete = [result, done = std::move(done)] {
+                    done(**result);
+                }};
+
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_stopping) {
+            return;
+        }
+        m_queue.push_back(std::move(write));
+    }
+    m_cv.notify_one();
+}
+
+void AsyncDatabase::writer_loop() {
+    while(true) {
+        vector<Write> batch{};
+        {
+            std::unique_lock lock{m_mutex};
+            m_cv.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+            if(m_queue.empty()) {
+                return;
+            }
+            m_cv.wait_for(lock, BATCH_WINDOW, [this] {
+                return m_stopping || m_queue.size() >= MAX_BATCH;
+            });
+
+            while(!m_queue.empty() && batch.size() < MAX_BATCH) {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+        run_batch(batch);
+    }
+}
+
+void AsyncDatabase::run_batch(vector<Write> &batch) {
+    if(!try_batch(batch)) {
+        // whatever went wrong took the whole transaction with it, so every
+        // write is retried on its own to find out how each of them fares
+        PLOG_WARNING << "group commit of " << batch.size()
+                     << " writes failed; running them one by one";
+        for(Write &write : batch) {
+            write.run();
+        }
+    }
+    m_writes += batch.size();
+    m_batches += 1;
+
+    for(Write &write : batch) {
+        try {
+            write.complete();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "uncaught exception in a database callback: "
+                       << e.what();
+        }
+    }
+}
+
+/// Runs the batch in a single transaction. Returns false (with the transaction
+/// rolled back) if it couldn't be committed.
+bool AsyncDatabase::try_batch(vector<Write> &batch) {
+    auto lock = m_db.lock();
+    if(m_db.begin_transaction().is_err()) {
+        return false;
+    }
+
+    for(Write &write : batch) {
+        if(m_db.savepoint().is_err()) {
+            m_db.rollback_transaction();
+            return false;
+        }
+        bool ok = write.run();
+        // a failed write is undone by itself, and leaves the others be
+        if((!ok && m_db.rollback_to_savepoint().is_err()) ||
+           m_db.release_savepoint().is_err())
+        {
+            m_db.rollback_transaction();
+            return false;
+        }
+    }
+
+    if(m_db.commit_transaction().is_err()) {
+        m_db.rollback_transaction();
+        return false;
+    }
+    return true;
+}
+
+void AsyncDatabase::insert_message(Message message, Callback<monostate> done) {
+    submit<monostate>(
+        [message = std::move(message)](const Database &db) {
+            return db.insert_message(message);
+        },
+        std::move(done));
+}
+
+void AsyncDatabase::store_session_token(string username, token_t token,
+                                        Callback<monostate> done) {
+    submit<monostate>(
+        [username = std::move(username), token](const Database &db) {
+            return db.store_session_token(username, token);
+        },
+        std::move(done));
+}
+
+void AsyncDatabase::delete_session_token(token_t token,
+                                         Callback<monostate> done) {
+    submit<monostate>(
+        [token](const Database &db) { return db.delete_session_token(token); },
+        std::move(done));
+}
+
+void AsyncDatabase::refresh_session_token(token_t token, int64_t expires,
+                                          Callback<monostate> done) {
+    submit<monostate>(
+        [token, expires](const Database &db) {
+            return db.refresh_session_token(token, expires);
+        },
+        std::move(done));
+}
+
+void AsyncDatabase::insert_short_link(string username, string mnemonic,
+                                      string link, Callback<monostate> done) {
+    submit<monostate>(
+        [username = std::move(username), mnemonic = std::move(mnemonic),
+         link = std::move(link)](const Database &db) {
+            return db.insert_short_link(username, mnemonic, link);
+        },
+        std::move(done));
+}
+
+void AsyncDatabase::set_visitors(int64_t visitors, Callback<monostate> done) {
+    submit<monostate>(
+        [visitors](const Database &db) { return db.set_visitors(visitors); },
+        std::move(done));
+}
+
+void AsyncDatabase::set_visitor_sketch(int64_t day, vector<uint8_t> sketch,
+                                       Callback<monostate> done) {
+    submit<monostate>(
+        [day, sketch = std::move(sketch)](const Database &db) {
+            return db.set_visitor_sketch(day, sketch);
+        },
+        std::move(done));
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "authconst.hpp"
+#include "db.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+/// Runs the database writes that requests make on a thread of their own, so
+/// that a slow commit holds up only the requests that are waiting on it. Each
+/// result is handed to a callback that runs on the database thread, so
+/// callbacks should pass it on rather than doing anything slow themselves.
+///
+/// Writes that arrive close together are group-committed: they share a single
+/// transaction, and so a single sync, but each one gets a savepoint of its own
+/// so that it succeeds or fails (e.g. with DbError::Unique) just as it would
+/// alone. Callbacks only run once the transaction has been committed.
+///
+/// Reads don't go through here: they run on the reader connections, alongside
+/// the writes.
+class AsyncDatabase {
+  private:
+    struct Write {
+        // runs the write and keeps its result, and returns whether it worked
+        std::function<bool()> run;
+        // passes the kept result on to the callback
+        std::function<void()> complete;
+    };
+
+    const Database &m_db;
+    std::deque<Write> m_queue{};
+    std::mutex m_mutex{};
+    std::condition_variable m_cv{};
+    bool m_stopping{false};
+    uint64_t m_writes{0};
+    uint64_t m_batches{0};
+    // declared last, so that it starts once everything else is ready
+    std::thread m_thread;
+
+    template <typename T, typename Op>
+    void submit(Op op, std::function<void(const DbResult<T> &)> done);
+    void writer_loop();
+    void run_batch(std::vector<Write> &batch);
+    bool try_batch(std::vector<Write> &batch);
+
+  public:
+    template <typename T>
+    using Callback = std::function<void(const DbResult<T> &)>;
+
+    AsyncDatabase() = delete;
+    AsyncDatabase(const AsyncDatabase &) = delete;
+    AsyncDatabase(AsyncDatabase &&) = delete;
+    explicit AsyncDatabase(const Database &db);
+    ~AsyncDatabase();
+
+    void insert_message(Message message, Callback<std::monostate> done);
+    void store_session_token(std::string username, token_t token,
+                             Callback<std::monostate> done);
+    void delete_session_token(token_t token, Callback<std::monostate> done);
+    void refresh_session_token(token_t token, int64_t expires,
+                               Callback<std::monostate> done);
+    void insert_short_link(std::string username, std::string mnemonic,
+                           std::string link, Callback<std::monostate> done);
+    void set_visitors(int64_t visitors, Callback<std::monostate> done);
+    void set_visitor_sketch(int64_t day, std::vector<uint8_t> sketch,
+                            Callback<std::monostate> done);
+
+    /// Finishes the queued writes (and their callbacks) and stops the thread.
+    /// Anything submitted afterwards is dropped.
+    void shutdown();
+};
\ No newline at end of file
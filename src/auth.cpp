@@ -13,12 +13,15 @@ extern "C" {
 #include <psa/crypto_values.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
 #include <variant>
 
-using std::string, std::array, std::monostate, std::span;
+using std::string, std::array, std::monostate, std::span, std::optional,
+    std::chrono::milliseconds;
 
 [[noreturn]] static void log_and_throw(const std::string &message) {
     PLOG_ERROR << message;
@@ -93,14 +96,14 @@ bool SHA256_HMAC::verify(std::span<uint8_t const> data, tag_t tag) const {
 
 // Token
 
-Result<Token, monostate> Token::parse(const string &input) {
+Result<Token, monostate> Token::parse(std::string_view input) {
     if(input.size() * 3 > (TOKEN_LENGTH + TAG_LENGTH + /* margin */ 2) * 4) {
         return {monostate{}, Err};
     }
 
     array<uint8_t, TOKEN_LENGTH + TAG_LENGTH + /* margin */ 4> buf{};
     size_t len{};
-    if(1 != base64_decode(input.c_str(), input.size(), (char *)buf.data(), &len,
+    if(1 != base64_decode(input.data(), input.size(), (char *)buf.data(), &len,
                           0) ||
        len != TOKEN_LENGTH + TAG_LENGTH)
     {
@@ -215,6 +218,103 @@ PBKDF2_SHA512_HMAC::~PBKDF2_SHA512_HMAC() {
     psa_key_derivation_abort(&m_operation);
 }
 
+// SessionCache
+
+constexpr size_t SESSION_CACHE_CAPACITY = 10000;
+constexpr int64_t DEAD_SESSION_LIFE_MILLIS = 1000 * 60 * 10;
+
+optional<SessionCache::Entry> SessionCache::find(const token_t &token,
+                                                 const tag_t &tag,
+                                                 int64_t current) {
+    std::lock_guard lock{m_mutex};
+    auto it = m_entries.find(token);
+    if(it == m_entries.end() ||
+       mbedtls_ct_memcmp(it->second.tag.data(), tag.data(), tag.size()) != 0)
+    {
+        m_misses++;
+        return {};
+    }
+
+    Entry &entry = it->second;
+    if(entry.expires <= current) {
+        m_entries.erase(it);
+        m_misses++;
+        return {};
+    }
+    if(entry.username.has_value() &&
+       entry.expires - current < TOKEN_LIFE_MILLIS - m_refresh_millis)
+    {
+        m_misses++;
+        return {};
+    }
+
+    m_hits++;
+    return entry;
+}
+
+void SessionCache::make_room(int64_t current) {
+    if(m_entries.size() < SESSION_CACHE_CAPACITY) {
+        return;
+    }
+
+    std::erase_if(m_entries, [current](const auto &item) {
+        return item.second.expires <= current;
+    });
+    if(m_entries.size() >= SESSION_CACHE_CAPACITY) {
+        // nothing's expired, so whatever comes first has to go. this only
+        // costs that session a trip to the database.
+        m_entries.erase(m_entries.begin());
+    }
+}
+
+void SessionCache::insert_live(const token_t &token, const tag_t &tag,
+                               const string &username, int64_t expires) {
+    std::lock_guard lock{m_mutex};
+    auto it = m_entries.find(token);
+    if(it != m_entries.end()) {
+        // a logout may have raced with the lookup that got here, and dead
+        // tokens never come back to life
+        if(!it->second.username.has_value() && it->second.tag == tag) {
+            return;
+        }
+        it->second = Entry{tag, username, expires};
+        return;
+    }
+
+    make_room(now<milliseconds>());
+    m_entries.emplace(token, Entry{tag, username, expires});
+}
+
+void SessionCache::insert_dead(const token_t &token, const tag_t &tag,
+                               int64_t current) {
+    std::lock_guard lock{m_mutex};
+    auto it = m_entries.find(token);
+    if(it == m_entries.end()) {
+        make_room(current);
+    }
+    m_entries.insert_or_assign(
+        token, Entry{tag, std::nullopt, current + DEAD_SESSION_LIFE_MILLIS});
+}
+
+int64_t SessionCache::get_cleanup_interval_seconds() {
+    return 60 * 5;
+}
+
+void SessionCache::perform_cleanup() {
+    int64_t current = now<milliseconds>();
+    size_t size{};
+    {
+        std::lock_guard lock{m_mutex};
+        std::erase_if(m_entries, [current](const auto &item) {
+            return item.second.expires <= current;
+        });
+        size = m_entries.size();
+    }
+
+    PLOG_INFO << "session cache: " << size << " entries, " << m_hits
+              << " hits, " << m_misses << " misses";
+}
+
 // Auth
 
 static mac_key_t get_or_generate_mac_key(const Database &db, int id) {
@@ -237,11 +337,13 @@ static mac_key_t get_or_generate_mac_key(const Database &db, int id) {
 constexpr int SESSION_KEY_ID = 0;
 constexpr int REGISTER_KEY_ID = 1;
 
-Auth Auth::with_db(const Database &db) {
+Auth Auth::with_db(const Database &db, AsyncDatabase &async_db,
+                   int64_t session_refresh_seconds) {
     mac_key_t session_key = get_or_generate_mac_key(db, SESSION_KEY_ID);
     mac_key_t register_key = get_or_generate_mac_key(db, REGISTER_KEY_ID);
 
-    return Auth(db, session_key, register_key);
+    return Auth(db, async_db, session_key, register_key,
+                session_refresh_seconds * 1000);
 }
 
 Result<Token, std::string> Auth::generate_registration_token() {
@@ -262,6 +364,17 @@ Result<monostate, string> Auth::register_user(const Token &token,
         return {"Invalid registration token.", Err};
     }
 
+    // the hash is derived before the transaction starts so that the database
+    // isn't held up by the key derivation
+    pw_salt_t salt{};
+    generate_random(salt);
+
+    PBKDF2_SHA512_HMAC hasher{};
+    hasher.provide_salt(salt);
+    hasher.provide_password(password);
+    pw_hash_t hash = hasher.get_hash();
+
+    auto lock = m_db.lock();
     if(m_db.begin_transaction().is_err()) {
         return {"DB error when registering user.", Err};
     }
@@ -272,14 +385,6 @@ Result<monostate, string> Auth::register_user(const Token &token,
         return {"Invalid registration token.", Err};
     }
 
-    pw_salt_t salt{};
-    generate_random(salt);
-
-    PBKDF2_SHA512_HMAC hasher{};
-    hasher.provide_salt(salt);
-    hasher.provide_password(password);
-    pw_hash_t hash = hasher.get_hash();
-
     auto ret2 = m_db.register_user(username, hash, salt);
     if(ret2.is_err() && ret2.get_err() == DbError::Unique) {
         m_db.rollback_transaction();
@@ -292,15 +397,16 @@ Result<monostate, string> Auth::register_user(const Token &token,
     m_db.commit_transaction();
     return {monostate{}, Ok};
 }
-Result<Token, string> Auth::login(const string &username,
-                                  const string &password) {
+void Auth::login(const string &username, const string &password,
+                 std::function<void(const Result<Token, string> &)> done) {
     auto creds = m_db.get_password_hash(username);
     if(creds.is_err()) {
         if(creds.get_err() == DbError::Nonexistent) {
-            return {"User does not exist.", Err};
+            done({"User does not exist.", Err});
         } else {
-            return {"DB error when logging in.", Err};
+            done({"DB error when logging in.", Err});
         }
+        return;
     }
     auto [hash, salt] = creds.get_ok();
 
@@ -309,19 +415,36 @@ Result<Token, string> Auth::login(const string &username,
     hasher.provide_password(password);
 
     if(!hasher.validate_hash(hash)) {
-        return {"Invalid password.", Err};
+        done({"Invalid password.", Err});
+        return;
     }
 
     token_t inner{};
     generate_random(inner);
     tag_t tag = m_session_hmac.sign(inner);
 
-    if(m_db.store_session_token(username, inner).is_err()) {
-        return {"DB error when storing token.", Err};
-    }
-    return {Token(inner, tag), Ok};
+    m_async_db.store_session_token(
+        username, inner,
+        [inner, tag, done = std::move(done)](const DbResult<monostate> &res) {
+            if(res.is_err()) {
+                done({"DB error when storing token.", Err});
+            } else {
+                done({Token(inner, tag), Ok});
+            }
+        });
 }
 Result<string, string> Auth::get_user_of_token(const Token &token) {
+    int64_t current = now<milliseconds>();
+    auto cached = m_sessions->find(token.m_inner, token.m_tag, current);
+    if(cached.has_value()) {
+        if(!cached->username.has_value()) {
+            return {"Expired token.", Err};
+        }
+        return {cached->username.value(), Ok};
+    }
+
+    // forged tokens aren't cached: the signature check is cheap enough, and
+    // caching them would let anyone flush out the real sessions
     if(!m_session_hmac.verify(token.m_inner, token.m_tag)) {
         return {"Invalid token signature.", Err};
     }
@@ -329,10 +452,44 @@ Result<string, string> Auth::get_user_of_token(const Token &token) {
     auto user_r = m_db.get_user_of_session_token(token.m_inner);
     if(user_r.is_err()) {
         if(user_r.get_err() == DbError::Nonexistent) {
+            m_sessions->insert_dead(token.m_inner, token.m_tag, current);
             return {"Expired token.", Err};
         } else {
             return {"DB error when getting identity of token holder.", Err};
         }
     }
-    return {user_r.get_ok(), Ok};
+
+    auto [username, expires] = user_r.get_ok();
+    // the expiry is only pushed back once the session has lost
+    // `m_session_refresh_millis` of its lifetime, so that most lookups stay
+    // reads. nobody has to wait for the write, since the cache already knows
+    // the new expiry.
+    if(expires - current < TOKEN_LIFE_MILLIS - m_session_refresh_millis) {
+        expires = current + TOKEN_LIFE_MILLIS;
+        m_async_db.refresh_session_token(
+            token.m_inner, expires, [](const DbResult<monostate> &res) {
+                if(res.is_err()) {
+                    PLOG_ERROR << "DB error when refreshing a session token";
+                }
+            });
+    }
+    m_sessions->insert_live(token.m_inner, token.m_tag, username, expires);
+    return {username, Ok};
+}
+
+Result<monostate, string> Auth::logout(const Token &token) {
+    if(!m_session_hmac.verify(token.m_inner, token.m_tag)) {
+        return {"Invalid token signature.", Err};
+    }
+
+    // the cache already turns the token away, so nothing has to wait for the
+    // database to catch up
+    m_sessions->insert_dead(token.m_inner, token.m_tag, now<milliseconds>());
+    m_async_db.delete_session_token(
+        token.m_inner, [](const DbResult<monostate> &res) {
+            if(res.is_err()) {
+                PLOG_ERROR << "DB error when deleting a session token";
+            }
+        });
+    return {monostate{}, Ok};
 }
\ No newline at end of file
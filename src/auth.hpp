@@ -1,14 +1,24 @@
 #pragma once
 
+#include "asyncdb.hpp"
 #include "authconst.hpp"
 #include "db.hpp"
+#include "ratelimit.hpp"
 #include "util.hpp"
 
 #include <psa/crypto.h>
 #include <psa/crypto_struct.h>
 #include <psa/crypto_types.h>
 
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
 
 class SHA256_HMAC {
@@ -39,7 +49,7 @@ class Token {
     friend class Auth;
 
   public:
-    static Result<Token, std::monostate> parse(const std::string &input);
+    static Result<Token, std::monostate> parse(std::string_view input);
     std::string to_string() const;
 };
 
@@ -62,27 +72,101 @@ class PBKDF2_SHA512_HMAC {
     ~PBKDF2_SHA512_HMAC();
 };
 
+/// Remembers who recently seen session tokens belong to, so that most requests
+/// can skip the database. Tokens that are known to be dead (expired, deleted or
+/// logged out) are remembered as well, for a while.
+class SessionCache : public ICleanup {
+  public:
+    struct Entry {
+        tag_t tag;
+        // empty for dead tokens
+        std::optional<std::string> username;
+        // for live tokens this is the expiry that's stored in the database;
+        // for dead ones it's when the entry should be forgotten
+        int64_t expires;
+    };
+
+  private:
+    struct TokenHash {
+        inline size_t operator()(const token_t &token) const {
+            // the tokens are random, so any part of them makes a fine hash
+            size_t hash{};
+            std::memcpy(&hash, token.data(), sizeof(hash));
+            return hash;
+        }
+    };
+
+    std::unordered_map<token_t, Entry, TokenHash> m_entries{};
+    std::mutex m_mutex{};
+    int64_t m_refresh_millis;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+
+    void make_room(int64_t current);
+
+  public:
+    inline explicit SessionCache(int64_t refresh_millis)
+        : m_refresh_millis{refresh_millis} {
+    }
+
+    /// Returns nothing if the database has to be asked, which is also the
+    /// case when a live session is due for having its expiry pushed back.
+    std::optional<Entry> find(const token_t &token, const tag_t &tag,
+                              int64_t current);
+    void insert_live(const token_t &token, const tag_t &tag,
+                     const std::string &username, int64_t expires);
+    void insert_dead(const token_t &token, const tag_t &tag, int64_t current);
+
+    inline uint64_t get_hits() const {
+        return m_hits;
+    }
+    inline uint64_t get_misses() const {
+        return m_misses;
+    }
+
+    int64_t get_cleanup_interval_seconds() override;
+    void perform_cleanup() override;
+};
+
 class Auth {
   private:
     const Database &m_db;
+    AsyncDatabase &m_async_db;
     SHA256_HMAC m_session_hmac;
     SHA256_HMAC m_register_hmac;
-
-    inline explicit Auth(const Database &db, mac_key_t session_hmac,
-                         mac_key_t register_hmac)
-        : m_db{db}, m_session_hmac{session_hmac}, m_register_hmac{
-                                                      register_hmac} {
+    // how much of its lifetime a session may lose before its expiry is
+    // pushed back
+    int64_t m_session_refresh_millis;
+    std::shared_ptr<SessionCache> m_sessions;
+
+    inline explicit Auth(const Database &db, AsyncDatabase &async_db,
+                         mac_key_t session_hmac, mac_key_t register_hmac,
+                         int64_t session_refresh_millis)
+        : m_db{db}, m_async_db{async_db}, m_session_hmac{session_hmac},
+          m_register_hmac{register_hmac},
+          m_session_refresh_millis{session_refresh_millis},
+          m_sessions{std::make_shared<SessionCache>(session_refresh_millis)} {
     }
 
   public:
-    static Auth with_db(const Database &db);
+    static Auth with_db(const Database &db, AsyncDatabase &async_db,
+                        int64_t session_refresh_seconds);
 
     Result<Token, std::string> generate_registration_token();
 
     Result<std::monostate, std::string> register_user(
         const Token &token, const std::string &username,
         const std::string &password);
-    Result<Token, std::string> login(const std::string &username,
-                                     const std::string &password);
+    /// Checks the password right away, but stores the new session on the
+    /// database thread, and `done` is called from there.
+    void login(const std::string &username, const std::string &password,
+               std::function<void(const Result<Token, std::string> &)> done);
     Result<std::string, std::string> get_user_of_token(const Token &token);
+    /// The session stops working immediately, but it's deleted from the
+    /// database in the background.
+    Result<std::monostate, std::string> logout(const Token &token);
+
+    inline std::shared_ptr<SessionCache> get_session_cache() {
+        return m_sessions;
+    }
 };
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include "config.hpp"
+#include "authconst.hpp"
 #include "plog/Log.h"
 #include "util.hpp"
 
 #include <algorithm>
 #include <nlohmann/json.hpp>
+#include <thread>
 
 using nlohmann::json, std::string, std::vector;
 using Res = Result<Config, ConfigError>;
@@ -23,10 +25,105 @@ std::string config_error_str(ConfigError err) {
         return "Could not find the certificate filename, or it wasn't a string";
     case ConfigError::BadDb:
         return "Could not find the DB connection string, or it wasn't a string";
+    case ConfigError::BadDbTuning:
+        return "The DB tuning section wasn't an object, or one of its settings "
+               "was invalid";
+    case ConfigError::BadWorkers:
+        return "The number of worker threads wasn't a positive integer";
+    case ConfigError::BadEventLoops:
+        return "The number of event loops wasn't a positive integer";
+    case ConfigError::BadSessionRefresh:
+        return "The session refresh interval wasn't a positive integer shorter "
+               "than the session lifetime";
+    case ConfigError::BadMaxConnections:
+        return "The connection limit wasn't a positive integer";
+    case ConfigError::BadMaxConnectionsPerIp:
+        return "The per-address connection limit wasn't a positive integer";
+    case ConfigError::BadAccessLog:
+        return "The access log filename wasn't a string";
+    case ConfigError::BadAccessLogFormat:
+        return "The access log format was neither \"text\" nor \"binary\"";
+    case ConfigError::BadMaxLostVisitors:
+        return "The number of visits that may be lost wasn't a positive "
+               "integer";
     }
 }
 
-const vector<string> allowed_keys{"listen_urls", "tls_key", "tls_cert", "db"};
+const vector<string> allowed_tuning_keys{"journal_mode", "synchronous",
+                                         "mmap_size", "cache_size_kib",
+                                         "busy_timeout_millis",
+                                         "reader_connections"};
+static Result<DbTuning, ConfigError> parse_db_tuning(const json &data) {
+    const vector<string> journal_modes{"DELETE", "TRUNCATE", "PERSIST", "WAL"};
+    const vector<string> sync_modes{"OFF", "NORMAL", "FULL", "EXTRA"};
+    // the value must be one of `allowed`, ignoring case
+    auto parse_mode = [&](const char *name, const vector<string> &allowed,
+                          string &mode) {
+        if(!data.contains(name)) {
+            return true;
+        }
+        if(!data[name].is_string()) {
+            return false;
+        }
+        string value = data[name];
+        std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+        if(std::find(allowed.begin(), allowed.end(), value) == allowed.end()) {
+            return false;
+        }
+        mode = value;
+        return true;
+    };
+    // `max` is the most that whatever the setting ends up in can take
+    auto parse_size = [&](const char *name, int64_t max, int64_t &size) {
+        if(!data.contains(name)) {
+            return true;
+        }
+        if(!(data[name].is_number_unsigned() &&
+             data[name].get<uint64_t>() <= (uint64_t)max))
+        {
+            return false;
+        }
+        size = data[name];
+        return true;
+    };
+
+    DbTuning tuning{};
+    if(!(data.is_object() &&
+         parse_mode("journal_mode", journal_modes, tuning.journal_mode) &&
+         parse_mode("synchronous", sync_modes, tuning.synchronous) &&
+         parse_size("mmap_size", INT64_MAX, tuning.mmap_size) &&
+         parse_size("cache_size_kib", INT32_MAX, tuning.cache_size_kib) &&
+         parse_size("busy_timeout_millis", INT32_MAX,
+                    tuning.busy_timeout_millis) &&
+         parse_size("reader_connections", MAX_READER_CONNECTIONS,
+                    tuning.reader_connections)))
+    {
+        return {ConfigError::BadDbTuning, Err};
+    }
+
+    for(const auto &[key, _] : data.items()) {
+        if(std::find(allowed_tuning_keys.begin(), allowed_tuning_keys.end(),
+                     key) == allowed_tuning_keys.end())
+        {
+            PLOG_WARNING << "unknown db_tuning option: " << key;
+        }
+    }
+    return {tuning, Ok};
+}
+
+const vector<string> allowed_keys{"listen_urls",
+                                  "tls_key",
+                                  "tls_cert",
+                                  "db",
+                                  "db_tuning",
+                                  "worker_threads",
+                                  "event_loops",
+                                  "session_refresh_seconds",
+                                  "max_connections",
+                                  "max_connections_per_ip",
+                                  "access_log",
+                                  "access_log_format",
+                                  "max_lost_visitors"};
 Res Config::from_file(const std::string &filename) {
     auto content_r = read_file(filename);
     if(content_r.is_err()) {
@@ -66,6 +163,97 @@ Res Config::from_file(const std::string &filename) {
     }
     string db = data["db"];
 
+    DbTuning db_tuning{};
+    if(data.contains("db_tuning")) {
+        auto tuning_r = parse_db_tuning(data["db_tuning"]);
+        if(tuning_r.is_err()) {
+            return {tuning_r.get_err(), Err};
+        }
+        db_tuning = tuning_r.get_ok();
+    }
+
+    size_t worker_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(data.contains("worker_threads")) {
+        if(!(data["worker_threads"].is_number_unsigned() &&
+             data["worker_threads"] > 0))
+        {
+            return {ConfigError::BadWorkers, Err};
+        }
+        worker_threads = data["worker_threads"];
+    }
+
+    size_t event_loops = 1;
+    if(data.contains("event_loops")) {
+        if(!(data["event_loops"].is_number_unsigned() &&
+             data["event_loops"] > 0))
+        {
+            return {ConfigError::BadEventLoops, Err};
+        }
+        event_loops = data["event_loops"];
+    }
+
+    // how often an active session's expiry gets pushed back in the database
+    int64_t session_refresh_seconds = 60 * 60;
+    if(data.contains("session_refresh_seconds")) {
+        if(!(data["session_refresh_seconds"].is_number_unsigned() &&
+             data["session_refresh_seconds"] > 0 &&
+             data["session_refresh_seconds"] < TOKEN_LIFE_SECONDS))
+        {
+            return {ConfigError::BadSessionRefresh, Err};
+        }
+        session_refresh_seconds = data["session_refresh_seconds"];
+    }
+
+    size_t max_connections = 50;
+    if(data.contains("max_connections")) {
+        if(!(data["max_connections"].is_number_unsigned() &&
+             data["max_connections"] > 0))
+        {
+            return {ConfigError::BadMaxConnections, Err};
+        }
+        max_connections = data["max_connections"];
+    }
+
+    size_t max_connections_per_ip = 10;
+    if(data.contains("max_connections_per_ip")) {
+        if(!(data["max_connections_per_ip"].is_number_unsigned() &&
+             data["max_connections_per_ip"] > 0))
+        {
+            return {ConfigError::BadMaxConnectionsPerIp, Err};
+        }
+        max_connections_per_ip = data["max_connections_per_ip"];
+    }
+
+    string access_log = "access.log";
+    if(data.contains("access_log")) {
+        if(!data["access_log"].is_string()) {
+            return {ConfigError::BadAccessLog, Err};
+        }
+        access_log = data["access_log"];
+    }
+
+    AccessLogFormat access_log_format = AccessLogFormat::Text;
+    if(data.contains("access_log_format")) {
+        if(data["access_log_format"] == "binary") {
+            access_log_format = AccessLogFormat::Binary;
+        } else if(data["access_log_format"] != "text") {
+            return {ConfigError::BadAccessLogFormat, Err};
+        }
+    }
+
+    // the visitor count is only written back every this many visits (or
+    // every few seconds), so up to this many can be lost in a crash. 1 stores
+    // every single visit.
+    int64_t max_lost_visitors = 100;
+    if(data.contains("max_lost_visitors")) {
+        if(!(data["max_lost_visitors"].is_number_unsigned() &&
+             data["max_lost_visitors"] > 0))
+        {
+            return {ConfigError::BadMaxLostVisitors, Err};
+        }
+        max_lost_visitors = data["max_lost_visitors"];
+    }
+
     for(const auto &[key, _] : data.items()) {
         if(std::find(allowed_keys.begin(), allowed_keys.end(), key) ==
            allowed_keys.end())
@@ -74,5 +262,9 @@ Res Config::from_file(const std::string &filename) {
         }
     }
 
-    return {Config(urls, key, cert, db), Ok};
+    return {Config(urls, key, cert, db, db_tuning, worker_threads, event_loops,
+                   session_refresh_seconds, max_connections,
+                   max_connections_per_ip, access_log, access_log_format,
+                   max_lost_visitors),
+            Ok};
 }
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "accesslog_format.hpp"
+#include "dbtuning.hpp"
 #include "util.hpp"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -18,6 +21,26 @@ enum class ConfigError {
     BadCert,
     // Could not find the DB connection string, or it wasn't a string
     BadDb,
+    // The DB tuning section wasn't an object, or one of its settings was
+    // invalid
+    BadDbTuning,
+    // The number of worker threads wasn't a positive integer
+    BadWorkers,
+    // The number of event loops wasn't a positive integer
+    BadEventLoops,
+    // The session refresh interval wasn't a positive integer shorter than the
+    // session lifetime
+    BadSessionRefresh,
+    // The connection limit wasn't a positive integer
+    BadMaxConnections,
+    // The per-address connection limit wasn't a positive integer
+    BadMaxConnectionsPerIp,
+    // The access log filename wasn't a string
+    BadAccessLog,
+    // The access log format was neither "text" nor "binary"
+    BadAccessLogFormat,
+    // The number of visits that may be lost wasn't a positive integer
+    BadMaxLostVisitors,
 };
 
 std::string config_error_str(ConfigError err);
@@ -28,14 +51,40 @@ class Config {
     std::string m_tls_key_filename;
     std::string m_tls_cert_filename;
     std::string m_db_connection;
+    DbTuning m_db_tuning;
+    size_t m_worker_threads;
+    size_t m_event_loops;
+    int64_t m_session_refresh_seconds;
+    size_t m_max_connections;
+    size_t m_max_connections_per_ip;
+    std::string m_access_log_filename;
+    AccessLogFormat m_access_log_format;
+    // how many visits may be counted without being stored, i.e. how many a
+    // crash can lose
+    int64_t m_max_lost_visitors;
 
     inline explicit Config(std::vector<std::string> listen_urls,
                            std::string tls_key_filename,
                            std::string tls_cert_filename,
-                           std::string db_connection)
+                           std::string db_connection, DbTuning db_tuning,
+                           size_t worker_threads, size_t event_loops,
+                           int64_t session_refresh_seconds,
+                           size_t max_connections,
+                           size_t max_connections_per_ip,
+                           std::string access_log_filename,
+                           AccessLogFormat access_log_format,
+                           int64_t max_lost_visitors)
         : m_listen_urls{listen_urls}, m_tls_key_filename{tls_key_filename},
           m_tls_cert_filename{tls_cert_filename},
-          m_db_connection{db_connection} {
+          m_db_connection{db_connection}, m_db_tuning{db_tuning},
+          m_worker_threads{worker_threads},
+          m_event_loops{event_loops},
+          m_session_refresh_seconds{session_refresh_seconds},
+          m_max_connections{max_connections},
+          m_max_connections_per_ip{max_connections_per_ip},
+          m_access_log_filename{access_log_filename},
+          m_access_log_format{access_log_format},
+          m_max_lost_visitors{max_lost_visitors} {
     }
 
   public:
@@ -52,4 +101,31 @@ class Config {
     const inline std::string &get_db_connection() const {
         return m_db_connection;
     }
+    const inline DbTuning &get_db_tuning() const {
+        return m_db_tuning;
+    }
+    inline size_t get_worker_threads() const {
+        return m_worker_threads;
+    }
+    inline size_t get_event_loops() const {
+        return m_event_loops;
+    }
+    inline int64_t get_session_refresh_seconds() const {
+        return m_session_refresh_seconds;
+    }
+    inline size_t get_max_connections() const {
+        return m_max_connections;
+    }
+    inline size_t get_max_connections_per_ip() const {
+        return m_max_connections_per_ip;
+    }
+    const inline std::string &get_access_log_filename() const {
+        return m_access_log_filename;
+    }
+    inline AccessLogFormat get_access_log_format() const {
+        return m_access_log_format;
+    }
+    inline int64_t get_max_lost_visitors() const {
+        return m_max_lost_visitors;
+    }
 };
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <sqlite/sqlite3.h>
 
 #include <chrono>
+#include <mutex>
 #include <span>
 #include <variant>
 
@@ -24,27 +25,20 @@ class Stmt {
   private:
     sqlite3_stmt *m_inner;
     int m_ret;
+    // points at the cache entry's flag, or is null if the statement isn't
+    // cached and has to be finalized
+    bool *m_in_use;
 
-    explicit Stmt(sqlite3_stmt *inner, int ret) : m_inner{inner}, m_ret{ret} {
+    explicit Stmt(sqlite3_stmt *inner, int ret, bool *in_use)
+        : m_inner{inner}, m_ret{ret}, m_in_use{in_use} {
     }
 
     Stmt(const Stmt &) = delete;
     Stmt(Stmt &&) = delete;
 
-  public:
-    static Stmt prepare(sqlite3 *conn, const string &str) {
-        sqlite3_stmt *stmt;
-        int ret =
-            sqlite3_prepare_v2(conn, str.c_str(), str.size(), &stmt, nullptr);
-
-        return Stmt(stmt, ret);
-    }
-    void reset_and_prepare(sqlite3 *conn, const string &str) {
-        sqlite3_reset(m_inner);
-        m_ret = sqlite3_prepare_v2(conn, str.c_str(), str.size(), &m_inner,
-                                   nullptr);
-    }
+    friend class Database;
 
+  public:
     int ret() const {
         return m_ret;
     }
@@ -84,30 +78,140 @@ class Stmt {
     }
 
     ~Stmt() {
-        sqlite3_finalize(m_inner);
+        if(nullptr == m_in_use) {
+            sqlite3_finalize(m_inner);
+            return;
+        }
+        // the bound text and blobs are SQLITE_STATIC, so they mustn't outlive
+        // this object
+        sqlite3_reset(m_inner);
+        sqlite3_clear_bindings(m_inner);
+        *m_in_use = false;
     }
 };
 
 // Database
 
-Database::Database(const string &connection_string) {
+Database::Database(const string &connection_string, const DbTuning &tuning) {
     PLOG_INFO << "connecting to database with connection string "
               << connection_string;
 
-    if(sqlite3_open(connection_string.c_str(), &m_connection) != SQLITE_OK) {
+    if(sqlite3_open(connection_string.c_str(), &m_writer.handle) !=
+       SQLITE_OK)
+    {
         PLOG_FATAL << "error when opening sqlite database: "
-                   << sqlite3_errmsg(m_connection);
+                   << sqlite3_errmsg(m_writer.handle);
         exit(1);
     }
     PLOG_INFO << "connected to database";
 
-    sqlite3_extended_result_codes(m_connection, 1);
+    sqlite3_extended_result_codes(m_writer.handle, 1);
+    apply_tuning(tuning);
     init_database();
+    open_readers(tuning);
 }
 
 Database::~Database() {
-    sqlite3_close(m_connection);
-    PLOG_INFO << "database connection closed";
+    size_t cached = 0;
+    auto close = [&cached](Connection &conn) {
+        cached += conn.statements.size();
+        for(auto &[sql, prepared] : conn.statements) {
+            sqlite3_finalize(prepared.stmt);
+        }
+        sqlite3_close(conn.handle);
+    };
+    for(auto &reader : m_readers) {
+        close(*reader);
+    }
+    close(m_writer);
+    PLOG_INFO << "database connections closed (" << cached
+              << " cached statements, " << m_prepare_count
+              << " prepared in total)";
+}
+
+// returns the current value of a pragma, as text
+static string query_pragma(sqlite3 *conn, const string &name) {
+    string value{};
+    auto callback = [](void *out, int columns, char **values, char **) {
+        if(columns > 0 && values[0] != nullptr) {
+            *(string *)out = values[0];
+        }
+        return 0;
+    };
+    sqlite3_exec(conn, ("PRAGMA " + name + ";").c_str(), callback, &value,
+                 nullptr);
+    return value;
+}
+
+// runs `stmts` on `conn`, and exits if they fail
+static void exec_pragmas(sqlite3 *conn, const string &stmts) {
+    char *err{nullptr};
+    sqlite3_exec(conn, stmts.c_str(), nullptr, nullptr, &err);
+    if(err != nullptr) {
+        PLOG_FATAL << "error when tuning the database: " << err;
+        exit(1);
+    }
+}
+
+// applies the settings that every connection has its own copy of
+static void tune_connection(sqlite3 *conn, const DbTuning &tuning) {
+    sqlite3_busy_timeout(conn, (int)tuning.busy_timeout_millis);
+
+    // a negative cache size is in KiB rather than in pages
+    exec_pragmas(conn, "PRAGMA mmap_size = " +
+                           std::to_string(tuning.mmap_size) + ";\n" +
+                           "PRAGMA cache_size = -" +
+                           std::to_string(tuning.cache_size_kib) + ";");
+}
+
+void Database::apply_tuning(const DbTuning &tuning) const {
+    sqlite3 *conn = m_writer.handle;
+    tune_connection(conn, tuning);
+    exec_pragmas(conn, "PRAGMA journal_mode = " + tuning.journal_mode +
+                           ";\n" + "PRAGMA synchronous = " +
+                           tuning.synchronous + ";");
+
+    // sqlite may not apply a setting as asked (e.g. in-memory databases can't
+    // use WAL), so what's logged is read back from it
+    PLOG_INFO << "database tuning: journal_mode="
+              << query_pragma(conn, "journal_mode")
+              << ", synchronous=" << query_pragma(conn, "synchronous")
+              << ", mmap_size=" << query_pragma(conn, "mmap_size")
+              << ", cache_size=" << query_pragma(conn, "cache_size")
+              << ", busy_timeout=" << query_pragma(conn, "busy_timeout")
+              << "ms";
+}
+
+void Database::open_readers(const DbTuning &tuning) {
+    if(tuning.reader_connections == 0) {
+        return;
+    }
+    // in-memory and temporary databases have no name, and can't be opened
+    // twice
+    const char *filename = sqlite3_db_filename(m_writer.handle, "main");
+    if(nullptr == filename || '\0' == *filename ||
+       query_pragma(m_writer.handle, "journal_mode") != "wal")
+    {
+        PLOG_INFO << "database isn't a file in WAL mode; all queries will go "
+                     "through a single connection";
+        return;
+    }
+
+    for(int64_t i = 0; i < tuning.reader_connections; i++) {
+        auto reader = std::make_unique<Connection>();
+        if(sqlite3_open_v2(filename, &reader->handle, SQLITE_OPEN_READONLY,
+                           nullptr) != SQLITE_OK)
+        {
+            PLOG_FATAL << "error when opening a read-only database connection: "
+                       << sqlite3_errmsg(reader->handle);
+            exit(1);
+        }
+        sqlite3_extended_result_codes(reader->handle, 1);
+        tune_connection(reader->handle, tuning);
+        m_readers.push_back(std::move(reader));
+    }
+    PLOG_INFO << "opened " << m_readers.size()
+              << " read-only database connections";
 }
 
 void Database::init_database() const {
@@ -120,10 +224,18 @@ CREATE TABLE IF NOT EXISTS visitors(
     id          INTEGER     NOT NULL PRIMARY KEY,
     visitors    INTEGER     NOT NULL
 );
+CREATE TABLE IF NOT EXISTS visitor_sketches(
+    day     INTEGER NOT NULL PRIMARY KEY,
+    sketch  BLOB    NOT NULL
+);
 CREATE TABLE IF NOT EXISTS sha256_hmac_key(
     id      INTEGER NOT NULL PRIMARY KEY,
     key     BLOB    NOT NULL
 );
+CREATE TABLE IF NOT EXISTS key_rotations(
+    id      INTEGER NOT NULL PRIMARY KEY,
+    rotated INTEGER NOT NULL
+);
 
 CREATE TABLE IF NOT EXISTS messages(
     id          INTEGER     NOT NULL PRIMARY KEY AUTOINCREMENT,
@@ -160,15 +272,66 @@ INSERT OR IGNORE INTO visitors (id, visitors) VALUES (0, 0);
     // clang-format on
 
     char *err{nullptr};
-    sqlite3_exec(m_connection, stmts.c_str(), nullptr, nullptr, &err);
+    sqlite3_exec(m_writer.handle, stmts.c_str(), nullptr, nullptr, &err);
     if(err != nullptr) {
         PLOG_FATAL << "error when creating tables:" << err;
         exit(1);
     }
 }
 
+Database::Connection &
+Database::reader(std::unique_lock<std::recursive_mutex> &lock) const {
+    if(m_readers.empty() ||
+       m_transaction_owner == std::this_thread::get_id())
+    {
+        lock = std::unique_lock{m_writer.mutex};
+        return m_writer;
+    }
+
+    // take the first idle reader, starting from a different one each time so
+    // that they're all kept warm, and wait for one if they're all busy
+    size_t start = m_next_reader++;
+    for(size_t i = 0; i < m_readers.size(); i++) {
+        Connection &conn = *m_readers[(start + i) % m_readers.size()];
+        lock = std::unique_lock{conn.mutex, std::try_to_lock};
+        if(lock.owns_lock()) {
+            return conn;
+        }
+    }
+    Connection &conn = *m_readers[start % m_readers.size()];
+    lock = std::unique_lock{conn.mutex};
+    return conn;
+}
+
+Stmt Database::statement(Connection &conn, std::string_view sql) const {
+    auto it = conn.statements.find(sql);
+    if(it != conn.statements.end() && !it->second.in_use) {
+        it->second.in_use = true;
+        return Stmt(it->second.stmt, SQLITE_OK, &it->second.in_use);
+    }
+
+    sqlite3_stmt *stmt{nullptr};
+    int ret = sqlite3_prepare_v3(conn.handle, sql.data(), sql.size(),
+                                 SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+    m_prepare_count++;
+
+    // the same statement may already be in use further up the stack, in which
+    // case this one is only used once
+    if(ret != SQLITE_OK || it != conn.statements.end()) {
+        return Stmt(stmt, ret, nullptr);
+    }
+    auto [inserted, _] =
+        conn.statements.emplace(string(sql), PreparedStatement{stmt, true});
+    return Stmt(stmt, ret, &inserted->second.in_use);
+}
+
+Stmt Database::statement(std::string_view sql) const {
+    return statement(m_writer, sql);
+}
+
 DbResult<std::monostate> Database::exec_simple(const string &stmt_str) const {
-    Stmt stmt = Stmt::prepare(m_connection, stmt_str);
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(stmt_str);
     ASSERT_STMT_OK;
 
     stmt.step();
@@ -176,26 +339,66 @@ DbResult<std::monostate> Database::exec_simple(const string &stmt_str) const {
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
+std::unique_lock<std::recursive_mutex> Database::lock() const {
+    return std::unique_lock{m_writer.mutex};
+}
+
+DbResult<monostate> Database::end_transaction(const string &stmt_str) const {
+    std::lock_guard lock{m_writer.mutex};
+    bool ok = exec_simple(stmt_str).is_ok();
+    // a failed COMMIT can leave the transaction open
+    if(sqlite3_get_autocommit(m_writer.handle)) {
+        m_transaction_owner = std::thread::id{};
+        // on a rollback this is one bump too many, which is harmless
+        if(m_messages_changed) {
+            m_messages_changed = false;
+            m_messages_version++;
+        }
+    }
+
+    if(!ok) {
+        return {DbError::Unknown, Err};
+    }
+    return {{}, Ok};
+}
+
 DbResult<monostate> Database::begin_transaction() const {
-    return exec_simple("BEGIN;");
+    std::lock_guard lock{m_writer.mutex};
+    if(exec_simple("BEGIN;").is_err()) {
+        return {DbError::Unknown, Err};
+    }
+    m_transaction_owner = std::this_thread::get_id();
+    return {{}, Ok};
 }
 
 DbResult<monostate> Database::rollback_transaction() const {
-    return exec_simple("ROLLBACK;");
+    return end_transaction("ROLLBACK;");
 }
 
 DbResult<monostate> Database::commit_transaction() const {
-    return exec_simple("COMMIT;");
+    return end_transaction("COMMIT;");
+}
+
+DbResult<monostate> Database::savepoint() const {
+    return exec_simple("SAVEPOINT write;");
+}
+
+DbResult<monostate> Database::rollback_to_savepoint() const {
+    return exec_simple("ROLLBACK TO write;");
 }
 
-DbResult<int64_t> Database::get_and_increase_visitors() const {
-    Stmt stmt = Stmt::prepare(
-        m_connection,
-        "UPDATE visitors SET visitors = visitors + 1 RETURNING visitors;");
+DbResult<monostate> Database::release_savepoint() const {
+    return exec_simple("RELEASE write;");
+}
+
+DbResult<int64_t> Database::get_visitors() const {
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt = statement(conn, "SELECT visitors FROM visitors WHERE id = 0;");
     ASSERT_STMT_OK;
 
     stmt.step();
@@ -203,14 +406,80 @@ DbResult<int64_t> Database::get_and_increase_visitors() const {
     return {stmt.column_int64(0), Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<monostate> Database::set_visitors(int64_t visitors) const {
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
+        "UPDATE visitors SET visitors = MAX(visitors, ?) WHERE id = 0;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_int64(1, visitors);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+    return {{}, Ok};
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<vector<uint8_t>> Database::get_visitor_sketch(int64_t day) const {
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt =
+        statement(conn, "SELECT sketch FROM visitor_sketches WHERE day = ?;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_int64(1, day);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    if(stmt.ret() == SQLITE_DONE) {
+        return {DbError::Nonexistent, Err};
+    }
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_ROW, err);
+    {
+        vector<uint8_t> sketch(stmt.column_bytes(0));
+        stmt.column_blob(0, sketch);
+        return {sketch, Ok};
+    }
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<monostate>
+Database::set_visitor_sketch(int64_t day, span<const uint8_t> sketch) const {
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
+        "INSERT INTO visitor_sketches(day, sketch) VALUES (?, ?) ON "
+        "CONFLICT(day) DO UPDATE SET sketch = excluded.sketch;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_int64(1, day);
+    ASSERT_STMT_OK;
+    stmt.bind_blob(2, sketch);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+    return {{}, Ok};
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<monostate> Database::insert_sha256_hmac_key(int id,
                                                      mac_key_t key) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection,
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
         "INSERT INTO sha256_hmac_key(id, key) VALUES (?, ?) ON CONFLICT(id) DO "
         "UPDATE SET key = excluded.key WHERE id = excluded.id;");
     ASSERT_STMT_OK;
@@ -225,13 +494,15 @@ DbResult<monostate> Database::insert_sha256_hmac_key(int id,
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<mac_key_t> Database::get_sha256_hmac_key(int id) const {
-    Stmt stmt = Stmt::prepare(m_connection,
-                              "SELECT key FROM sha256_hmac_key WHERE id = ?;");
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt =
+        statement(conn, "SELECT key FROM sha256_hmac_key WHERE id = ?;");
     ASSERT_STMT_OK;
 
     stmt.bind_int64(1, id);
@@ -248,16 +519,61 @@ DbResult<mac_key_t> Database::get_sha256_hmac_key(int id) const {
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<int64_t> Database::get_key_rotation_time(int id) const {
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt =
+        statement(conn, "SELECT rotated FROM key_rotations WHERE id = ?;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_int64(1, id);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    if(stmt.ret() == SQLITE_ROW) {
+        return {stmt.column_int64(0), Ok};
+    } else if(stmt.ret() == SQLITE_DONE) {
+        return {DbError::Nonexistent, Err};
+    }
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<monostate> Database::set_key_rotation_time(int id,
+                                                    int64_t rotated) const {
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
+        "INSERT INTO key_rotations(id, rotated) VALUES (?, ?) ON CONFLICT(id) "
+        "DO UPDATE SET rotated = excluded.rotated;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_int64(1, id);
+    ASSERT_STMT_OK;
+    stmt.bind_int64(2, rotated);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+    return {{}, Ok};
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<vector<Message>> Database::get_messages() const {
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
     vector<Message> output{};
 
-    Stmt stmt = Stmt::prepare(
-        m_connection,
-        "SELECT name, content, timestamp FROM messages ORDER BY id DESC;");
+    Stmt stmt = statement(conn, "SELECT name, content, timestamp FROM "
+                                "messages ORDER BY id DESC;");
     ASSERT_STMT_OK;
 
     while(true) {
@@ -277,47 +593,57 @@ DbResult<vector<Message>> Database::get_messages() const {
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<monostate> Database::insert_message(const Message &message) const {
-    Stmt stmt = Stmt::prepare(m_connection,
-                              "INSERT INTO messages(name, content, timestamp, "
+    std::lock_guard lock{m_writer.mutex};
+    {
+        Stmt stmt = statement("INSERT INTO messages(name, content, timestamp, "
                               "ip) VALUES (?, ?, ?, ?);");
-    ASSERT_STMT_OK;
+        ASSERT_STMT_OK;
 
-    stmt.bind_text(1, message.name);
-    ASSERT_STMT_OK;
-    stmt.bind_text(2, message.content);
-    ASSERT_STMT_OK;
-    stmt.bind_int64(3, now<std::chrono::milliseconds>());
-    ASSERT_STMT_OK;
-    stmt.bind_text(4, message.ip);
-    ASSERT_STMT_OK;
+        stmt.bind_text(1, message.name);
+        ASSERT_STMT_OK;
+        stmt.bind_text(2, message.content);
+        ASSERT_STMT_OK;
+        stmt.bind_int64(3, now<std::chrono::milliseconds>());
+        ASSERT_STMT_OK;
+        stmt.bind_text(4, message.ip);
+        ASSERT_STMT_OK;
 
-    stmt.step();
-    if(stmt.ret() == SQLITE_CONSTRAINT_UNIQUE) {
-        return {DbError::Unique, Err};
+        stmt.step();
+        if(stmt.ret() == SQLITE_CONSTRAINT_UNIQUE) {
+            return {DbError::Unique, Err};
+        }
+        ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
     }
-    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
-
-    stmt.reset_and_prepare(m_connection, "DELETE FROM messages WHERE id <= "
-                                         "(SELECT MAX(id) FROM messages) - 8;");
-    ASSERT_STMT_OK;
+    {
+        Stmt stmt = statement("DELETE FROM messages WHERE id <= "
+                              "(SELECT MAX(id) FROM messages) - 8;");
+        ASSERT_STMT_OK;
 
-    stmt.step();
-    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+        stmt.step();
+        ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+    }
+    if(sqlite3_get_autocommit(m_writer.handle)) {
+        m_messages_version++;
+    } else {
+        m_messages_changed = true;
+    }
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<bool> Database::user_exists(const std::string &username) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection, "SELECT EXISTS(SELECT 1 FROM users WHERE username = ?);");
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt = statement(
+        conn, "SELECT EXISTS(SELECT 1 FROM users WHERE username = ?);");
     ASSERT_STMT_OK;
 
     stmt.bind_text(1, username);
@@ -328,14 +654,14 @@ DbResult<bool> Database::user_exists(const std::string &username) const {
     return {(bool)stmt.column_int64(0), Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<std::monostate> Database::store_registration_token(
     token_t token) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection, "INSERT INTO registration_tokens(token) VALUES (?);");
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement("INSERT INTO registration_tokens(token) VALUES (?);");
     ASSERT_STMT_OK;
 
     stmt.bind_blob(1, token);
@@ -346,14 +672,14 @@ DbResult<std::monostate> Database::store_registration_token(
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<std::monostate> Database::redeem_registration_token(
     token_t token) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection,
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
         "DELETE FROM registration_tokens WHERE token = ? RETURNING 1;");
     ASSERT_STMT_OK;
 
@@ -368,16 +694,16 @@ DbResult<std::monostate> Database::redeem_registration_token(
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<monostate> Database::register_user(const string &username,
                                             pw_hash_t password_hash,
                                             pw_salt_t salt) const {
-    Stmt stmt = Stmt::prepare(m_connection,
-                              "INSERT INTO users(username, password_hash, "
-                              "password_salt) VALUES (?, ?, ?);");
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement("INSERT INTO users(username, password_hash, "
+                          "password_salt) VALUES (?, ?, ?);");
     ASSERT_STMT_OK;
 
     stmt.bind_text(1, username);
@@ -395,15 +721,17 @@ DbResult<monostate> Database::register_user(const string &username,
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<pair<pw_hash_t, pw_salt_t>> Database::get_password_hash(
     const string &username) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection,
-        "SELECT password_hash, password_salt FROM users WHERE username = ?;");
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt = statement(conn,
+                          "SELECT password_hash, password_salt FROM users "
+                          "WHERE username = ?;");
     ASSERT_STMT_OK;
 
     stmt.bind_text(1, username);
@@ -425,15 +753,15 @@ DbResult<pair<pw_hash_t, pw_salt_t>> Database::get_password_hash(
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<monostate> Database::store_session_token(const string &username,
                                                   token_t token) const {
-    Stmt stmt =
-        Stmt::prepare(m_connection, "INSERT INTO session_tokens(token, "
-                                    "username, expires) VALUES(?, ?, ?);");
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement("INSERT INTO session_tokens(token, "
+                          "username, expires) VALUES(?, ?, ?);");
     ASSERT_STMT_OK;
 
     stmt.bind_blob(1, token);
@@ -448,13 +776,30 @@ DbResult<monostate> Database::store_session_token(const string &username,
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<monostate> Database::delete_session_token(token_t token) const {
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement("DELETE FROM session_tokens WHERE token = ?;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_blob(1, token);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+    return {{}, Ok};
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<std::monostate> Database::cleanup_session_tokens() const {
-    Stmt stmt = Stmt::prepare(m_connection,
-                              "DELETE FROM session_tokens WHERE expires < ?;");
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement("DELETE FROM session_tokens WHERE expires < ?;");
     ASSERT_STMT_OK;
 
     stmt.bind_int64(1, now<milliseconds>());
@@ -465,41 +810,62 @@ DbResult<std::monostate> Database::cleanup_session_tokens() const {
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
-DbResult<string> Database::get_user_of_session_token(token_t token) const {
-    int64_t current = now<milliseconds>();
-    Stmt stmt = Stmt::prepare(m_connection,
-                              "UPDATE session_tokens SET expires = ? WHERE "
-                              "expires > ? AND token = ? RETURNING username;");
+DbResult<pair<string, int64_t>> Database::get_user_of_session_token(
+    token_t token) const {
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt = statement(conn, "SELECT username, expires FROM "
+                                "session_tokens WHERE expires > ? AND "
+                                "token = ?;");
     ASSERT_STMT_OK;
 
-    stmt.bind_int64(1, current + TOKEN_LIFE_MILLIS);
-    ASSERT_STMT_OK;
-    stmt.bind_int64(2, current);
+    stmt.bind_int64(1, now<milliseconds>());
     ASSERT_STMT_OK;
-    stmt.bind_blob(3, token);
+    stmt.bind_blob(2, token);
     ASSERT_STMT_OK;
 
     stmt.step();
-    if(stmt.ret() == SQLITE_ROW) {
-        return {stmt.column_text(0), Ok};
-    } else if(stmt.ret() == SQLITE_DONE) {
+    if(stmt.ret() == SQLITE_DONE) {
         return {DbError::Nonexistent, Err};
     }
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_ROW, err);
+    return {{stmt.column_text(0), stmt.column_int64(1)}, Ok};
+
+err:
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
+    return {DbError::Unknown, Err};
+}
+
+DbResult<monostate> Database::refresh_session_token(token_t token,
+                                                    int64_t expires) const {
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement("UPDATE session_tokens SET expires = ? "
+                          "WHERE token = ?;");
+    ASSERT_STMT_OK;
+
+    stmt.bind_int64(1, expires);
+    ASSERT_STMT_OK;
+    stmt.bind_blob(2, token);
+    ASSERT_STMT_OK;
+
+    stmt.step();
+    ASSERT_EQ_OR_GOTO(stmt.ret(), SQLITE_DONE, err);
+    return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<monostate> Database::insert_short_link(const string &username,
                                                 const string &mnemonic,
                                                 const string &link) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection,
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
         "INSERT INTO shorts(username, mnemonic, link) VALUES(?, ?, ?);");
     ASSERT_STMT_OK;
 
@@ -518,13 +884,15 @@ DbResult<monostate> Database::insert_short_link(const string &username,
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<string> Database::get_short_link(const string &mnemonic) const {
-    Stmt stmt = Stmt::prepare(m_connection,
-                              "SELECT link FROM shorts WHERE mnemonic = ?;");
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
+    Stmt stmt =
+        statement(conn, "SELECT link FROM shorts WHERE mnemonic = ?;");
     ASSERT_STMT_OK;
 
     stmt.bind_text(1, mnemonic);
@@ -538,16 +906,18 @@ DbResult<string> Database::get_short_link(const string &mnemonic) const {
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<vector<pair<string, string>>> Database::get_user_links(
     const string &username) const {
+    std::unique_lock<std::recursive_mutex> lock{};
+    Connection &conn = reader(lock);
     vector<pair<string, string>> result{};
-    Stmt stmt =
-        Stmt::prepare(m_connection, "SELECT mnemonic, link FROM shorts WHERE "
-                                    "username = ? ORDER BY id DESC;");
+    Stmt stmt = statement(conn,
+                          "SELECT mnemonic, link FROM shorts WHERE "
+                          "username = ? ORDER BY id DESC;");
     ASSERT_STMT_OK;
 
     stmt.bind_text(1, username);
@@ -565,14 +935,14 @@ DbResult<vector<pair<string, string>>> Database::get_user_links(
     }
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(conn.handle);
     return {DbError::Unknown, Err};
 }
 
 DbResult<monostate> Database::delete_short_link(const string &username,
                                                 const string &mnemonic) const {
-    Stmt stmt = Stmt::prepare(
-        m_connection,
+    std::lock_guard lock{m_writer.mutex};
+    Stmt stmt = statement(
         "DELETE FROM shorts WHERE username = ? AND mnemonic = ?;");
     ASSERT_STMT_OK;
 
@@ -586,7 +956,7 @@ DbResult<monostate> Database::delete_short_link(const string &username,
     return {{}, Ok};
 
 err:
-    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_connection);
+    PLOG_ERROR << "sqlite error: " << sqlite3_errmsg(m_writer.handle);
     return {DbError::Unknown, Err};
 }
 
@@ -598,4 +968,6 @@ int64_t SessionTokenCleanup::get_cleanup_interval_seconds() {
 
 void SessionTokenCleanup::perform_cleanup() {
     m_db.cleanup_session_tokens();
+    PLOG_DEBUG << "database: " << m_db.get_prepare_count()
+               << " statements prepared so far";
 }
\ No newline at end of file
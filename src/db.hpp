@@ -1,12 +1,20 @@
 #pragma once
 
 #include "authconst.hpp"
+#include "dbtuning.hpp"
 #include "ratelimit.hpp"
 #include "util.hpp"
 
 #include <sqlite/sqlite3.h>
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 enum class DbError {
@@ -17,6 +25,11 @@ enum class DbError {
 
 template <typename T> using DbResult = Result<T, DbError>;
 
+/// The "day" that the all-time unique visitor sketch is stored under.
+constexpr int64_t ALL_TIME_SKETCH = -1;
+
+class Stmt;
+
 struct Message {
     std::string name;
     std::string content;
@@ -26,29 +39,105 @@ struct Message {
 
 class Database {
   private:
-    sqlite3 *m_connection{nullptr};
-
+    struct PreparedStatement {
+        sqlite3_stmt *stmt;
+        // set while a Stmt is using it
+        bool in_use;
+    };
+    struct Connection {
+        sqlite3 *handle{nullptr};
+        // held for as long as any of the connection's statements are in use
+        std::recursive_mutex mutex{};
+        // every statement is prepared the first time it's used and kept until
+        // the connection is closed, keyed by its SQL
+        std::map<std::string, PreparedStatement, std::less<>> statements{};
+    };
+
+    // all writes go through this one
+    mutable Connection m_writer{};
+    // read-only connections, which WAL lets run alongside the writer. This is
+    // empty if the database can't be shared between connections.
+    std::vector<std::unique_ptr<Connection>> m_readers{};
+    mutable std::atomic<size_t> m_next_reader{0};
+    // the thread that has a transaction open on the writer, if any. Its reads
+    // go to the writer too, so that they see what it hasn't committed yet.
+    mutable std::atomic<std::thread::id> m_transaction_owner{};
+    mutable std::atomic<uint64_t> m_prepare_count{0};
+    mutable std::atomic<uint64_t> m_messages_version{0};
+    // set when messages change inside a transaction, so that the version is
+    // only bumped once the change can actually be read
+    mutable bool m_messages_changed{false};
+
+    void apply_tuning(const DbTuning &tuning) const;
     void init_database() const;
+    void open_readers(const DbTuning &tuning);
+    /// Locks a connection for a read-only query: an idle reader if there is
+    /// one, or the writer if there are no readers or the calling thread is in
+    /// a transaction.
+    Connection &reader(std::unique_lock<std::recursive_mutex> &lock) const;
+    /// Hands out the cached statement for `sql` on `conn`, reset and with no
+    /// bindings, preparing it first if needed. The connection must stay locked
+    /// for as long as the returned Stmt lives.
+    Stmt statement(Connection &conn, std::string_view sql) const;
+    /// The same, on the writer.
+    Stmt statement(std::string_view sql) const;
 
     DbResult<std::monostate> exec_simple(const std::string &stmt_str) const;
+    /// Runs a COMMIT or ROLLBACK, and keeps track of whether the transaction
+    /// is still open.
+    DbResult<std::monostate> end_transaction(const std::string &stmt_str) const;
 
   public:
     Database() = delete;
     Database(const Database &) = delete;
     Database(Database &&) = delete;
-    Database(const std::string &connection_string);
+    Database(const std::string &connection_string, const DbTuning &tuning);
     ~Database();
 
+    /// Every method locks the connection that it uses for its own duration.
+    /// This is the lock of the writer, which all writes go through; hold it to
+    /// keep other writers out across several calls, e.g. for the length of a
+    /// transaction. Reads from other threads carry on regardless.
+    std::unique_lock<std::recursive_mutex> lock() const;
     DbResult<std::monostate> begin_transaction() const;
     DbResult<std::monostate> rollback_transaction() const;
     DbResult<std::monostate> commit_transaction() const;
+    /// Savepoints nest inside a transaction, so that part of it can be undone
+    /// without giving up on the rest.
+    DbResult<std::monostate> savepoint() const;
+    DbResult<std::monostate> rollback_to_savepoint() const;
+    DbResult<std::monostate> release_savepoint() const;
+
+    /// How many times a statement has been compiled. This stops growing once
+    /// every query has been used once.
+    inline uint64_t get_prepare_count() const {
+        return m_prepare_count;
+    }
 
-    DbResult<int64_t> get_and_increase_visitors() const;
+    DbResult<int64_t> get_visitors() const;
+    /// Never lowers the count, so flushes that race each other can't lose
+    /// visits.
+    DbResult<std::monostate> set_visitors(int64_t visitors) const;
+    /// The unique visitor sketch of a day, counted in days since the epoch,
+    /// or of all time for ALL_TIME_SKETCH.
+    DbResult<std::vector<uint8_t>> get_visitor_sketch(int64_t day) const;
+    DbResult<std::monostate>
+    set_visitor_sketch(int64_t day, std::span<const uint8_t> sketch) const;
     DbResult<std::monostate> insert_sha256_hmac_key(int id,
                                                     mac_key_t key) const;
     DbResult<mac_key_t> get_sha256_hmac_key(int id) const;
+    /// When the key with the given id was last replaced, in seconds since the
+    /// epoch, for keys that have to be rotated on a schedule.
+    DbResult<int64_t> get_key_rotation_time(int id) const;
+    DbResult<std::monostate> set_key_rotation_time(int id,
+                                                   int64_t rotated) const;
 
     DbResult<std::vector<Message>> get_messages() const;
+    /// Goes up whenever a change to the messages is committed, so anything
+    /// built from get_messages() is current as long as this hasn't moved.
+    inline uint64_t get_messages_version() const {
+        return m_messages_version;
+    }
     DbResult<std::monostate> insert_message(const Message &message) const;
 
     DbResult<bool> user_exists(const std::string &username) const;
@@ -61,8 +150,13 @@ class Database {
         const std::string &username) const;
     DbResult<std::monostate> store_session_token(const std::string &username,
                                                  token_t token) const;
+    DbResult<std::monostate> delete_session_token(token_t token) const;
     DbResult<std::monostate> cleanup_session_tokens() const;
-    DbResult<std::string> get_user_of_session_token(token_t token) const;
+    /// Also returns the session's expiry.
+    DbResult<std::pair<std::string, int64_t>> get_user_of_session_token(
+        token_t token) const;
+    DbResult<std::monostate> refresh_session_token(token_t token,
+                                                   int64_t expires) const;
 
     DbResult<std::monostate> insert_short_link(const std::string &username,
                                                const std::string &mnemonic,
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// each reader is opened (and keeps its own page cache) from the start, so
+// there's no point in having many more of them than there are threads
+constexpr int64_t MAX_READER_CONNECTIONS = 64;
+
+/// SQLite settings that are applied to the connection before anything else is
+/// done with it. The defaults are what the server should run with in
+/// production.
+struct DbTuning {
+    // one of DELETE, TRUNCATE, PERSIST or WAL. WAL lets readers carry on
+    // while a write is in progress.
+    std::string journal_mode{"WAL"};
+    // one of OFF, NORMAL, FULL or EXTRA. NORMAL is safe in WAL mode, where a
+    // power loss can only roll back the last few commits.
+    std::string synchronous{"NORMAL"};
+    // how much of the database file may be memory-mapped, in bytes
+    int64_t mmap_size{256 * 1024 * 1024};
+    // the size of the page cache, in KiB
+    int64_t cache_size_kib{64 * 1024};
+    // how long to wait for another connection's lock before giving up
+    int64_t busy_timeout_millis{5000};
+    // how many read-only connections to open next to the one that writes,
+    // up to MAX_READER_CONNECTIONS. These are only used in WAL mode.
+    int64_t reader_connections{4};
+};
\ No newline at end of file
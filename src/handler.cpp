@@ -3,30 +3,173 @@
 
 #include <mongoose/mongoose.h>
 
-#include <sstream>
+#include <cstring>
+#include <memory_resource>
 
-using std::string, std::stringstream;
+using std::string, std::vector;
+
+// Responses
+
+static std::string_view status_text(int status_code) {
+    switch(status_code) {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 301:
+        return "Moved Permanently";
+    case 302:
+        return "Found";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 401:
+        return "Unauthorized";
+    case 403:
+        return "Forbidden";
+    case 404:
+        return "Not Found";
+    case 413:
+        return "Payload Too Large";
+    case 429:
+        return "Too Many Requests";
+    case 500:
+        return "Internal Server Error";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "";
+    }
+}
+
+std::string_view content_type_header(ContentType ct) {
+    switch(ct) {
+    case ContentType::TextPlain:
+        return "Content-Type: text/plain\r\n";
+    case ContentType::TextHtml:
+        return "Content-Type: text/html\r\n";
+    case ContentType::ApplicationJson:
+        return "Content-Type: application/json\r\n";
+    }
+    return {};
+}
+
+size_t write_response(mg_connection *conn, int status_code,
+                      std::span<const std::string_view> header_blocks,
+                      std::span<const std::string_view> body) {
+    std::string_view reason = status_text(status_code);
+    char status_line[64];
+    size_t status_len =
+        mg_snprintf(status_line, sizeof(status_line), "HTTP/1.1 %d %.*s\r\n",
+                    status_code, (int)reason.size(), reason.data());
+
+    // these never have a body, and mustn't claim a length that isn't the one
+    // the full response would have had (RFC 9110, 8.6)
+    bool bodyless = status_code == 204 || status_code == 304;
+    if(bodyless) {
+        body = {};
+    }
+
+    size_t body_len = 0;
+    for(std::string_view fragment : body) {
+        body_len += fragment.size();
+    }
+    char length_line[48];
+    size_t length_len =
+        bodyless ? mg_snprintf(length_line, sizeof(length_line), "\r\n")
+                 : mg_snprintf(length_line, sizeof(length_line),
+                               "Content-Length: %lu\r\n\r\n",
+                               (unsigned long)body_len);
+
+    size_t total = status_len + length_len + body_len;
+    for(std::string_view block : header_blocks) {
+        total += block.size();
+    }
+
+    mg_iobuf &out = conn->send;
+    if(out.size < out.len + total && !mg_iobuf_resize(&out, out.len + total)) {
+        mg_error(conn, "OOM");
+        return 0;
+    }
+    auto append = [&out](std::string_view data) {
+        std::memcpy(out.buf + out.len, data.data(), data.size());
+        out.len += data.size();
+    };
+
+    append({status_line, status_len});
+    for(std::string_view block : header_blocks) {
+        append(block);
+    }
+    append({length_line, length_len});
+    for(std::string_view fragment : body) {
+        append(fragment);
+    }
+
+    // same as mg_http_reply: the response is complete, so mongoose can move on
+    // to the next request on this connection
+    conn->is_resp = 0;
+    return total;
+}
 
 // HttpResponse
 
-string HttpResponse::header_string() const {
-    stringstream stream{};
+std::pmr::string HttpResponse::header_string(
+    std::pmr::memory_resource *arena) const {
+    size_t size = 0;
     for(const auto &[key, val] : headers) {
-        stream << key << ": " << val << "\r\n";
+        size += key.size() + val.size() + 4;
     }
 
-    return stream.str();
+    std::pmr::string result{arena};
+    result.reserve(size);
+    for(const auto &[key, val] : headers) {
+        result.append(key).append(": ").append(val).append("\r\n");
+    }
+    return result;
+}
+
+void HttpResponse::send(mg_connection *conn, RequestContext &ctx) const {
+    // the headers are only needed until they're copied into the send buffer
+    char buf[512];
+    std::pmr::monotonic_buffer_resource arena{buf, sizeof(buf)};
+    auto headers{header_string(&arena)};
+
+    std::string_view header_blocks[] = {
+        content_type.has_value() ? content_type_header(*content_type) : "",
+        headers};
+    std::string_view fragments[] = {body};
+    ctx.status_code = status_code;
+    ctx.response_size =
+        write_response(conn, status_code, header_blocks, fragments);
 }
 
 // SimpleHandler
 
 void SimpleHandler::handle(mg_connection *conn, Server &server,
-                           const HttpMessage &msg, bool &confidential) {
-    auto response{respond(server, msg, confidential)};
-    auto headers{response.header_string()};
-    mg_http_reply(conn, response.status_code,
-                  headers.size() > 0 ? headers.c_str() : NULL, "%s",
-                  response.body.c_str());
+                           const HttpMessage &msg, RequestContext &ctx) {
+    respond(server, msg, ctx).send(conn, ctx);
+}
+
+// mongoose doesn't tell us how it answered a request for a file, but its
+// replies always start with "HTTP/1.1 NNN ", so the status code is at a fixed
+// offset from wherever the send buffer ended before the reply.
+static void record_served(const mg_connection *conn, size_t start,
+                          RequestContext &ctx) {
+    constexpr size_t STATUS_OFFSET = sizeof("HTTP/1.1 ") - 1;
+    ctx.response_size = conn->send.len - start;
+    ctx.status_code = 0;
+    if(ctx.response_size < STATUS_OFFSET + 3) {
+        return;
+    }
+    for(size_t i = 0; i < 3; i++) {
+        unsigned char ch = conn->send.buf[start + STATUS_OFFSET + i];
+        if(ch < '0' || ch > '9') {
+            ctx.status_code = 0;
+            return;
+        }
+        ctx.status_code = ctx.status_code * 10 + (ch - '0');
+    }
 }
 
 // DirHandler
@@ -34,15 +177,17 @@ DirHandler::DirHandler(const string &path_prefix, const string &root)
     : m_path_prefix{path_prefix}, m_root_dir_arg{path_prefix + '=' + root} {
 }
 
-bool DirHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" &&
-           msg.get_uri().starts_with(m_path_prefix);
+vector<Route> DirHandler::routes() const {
+    return {{"GET", m_path_prefix + '#'}};
 }
 
-void DirHandler::handle(mg_connection *conn, Server &, const HttpMessage &msg) {
+void DirHandler::handle(mg_connection *conn, Server &, const HttpMessage &msg,
+                        RequestContext &ctx) {
     mg_http_serve_opts opts{};
     opts.root_dir = m_root_dir_arg.c_str();
+    size_t start = conn->send.len;
     mg_http_serve_dir(conn, msg.m_msg, &opts);
+    record_served(conn, start, ctx);
 }
 
 // FileHandler
@@ -51,12 +196,14 @@ FileHandler::FileHandler(const string &uri, const string &path)
     : m_uri{uri}, m_path{path} {
 }
 
-bool FileHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == m_uri;
+vector<Route> FileHandler::routes() const {
+    return {{"GET", m_uri}};
 }
 
-void FileHandler::handle(mg_connection *conn, Server &,
-                         const HttpMessage &msg) {
+void FileHandler::handle(mg_connection *conn, Server &, const HttpMessage &msg,
+                         RequestContext &ctx) {
     mg_http_serve_opts opts{};
+    size_t start = conn->send.len;
     mg_http_serve_file(conn, msg.m_msg, m_path.c_str(), &opts);
+    record_served(conn, start, ctx);
 }
\ No newline at end of file
@@ -1,9 +1,18 @@
 #pragma once
 
+#include "router.hpp"
+
 #include <mongoose/mongoose.h>
 
+#include <chrono>
+#include <functional>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 class HttpMessage;
 class Server;
@@ -14,35 +23,65 @@ enum class ContentType {
     ApplicationJson,
 };
 
-static const char *content_type_to_string(ContentType ct) {
-    switch(ct) {
-    case ContentType::TextPlain:
-        return "text/plain";
-    case ContentType::TextHtml:
-        return "text/html";
-    case ContentType::ApplicationJson:
-        return "application/json";
-    }
-}
+/// The whole header line, ready to be sent.
+std::string_view content_type_header(ContentType ct);
+
+/// Appends a complete response to the connection's send buffer: the status
+/// line, the header blocks (each made of whole "Name: value\r\n" lines, so
+/// that fixed ones can be prepared ahead of time), the Content-Length, and then
+/// the body fragments back to back. 204 and 304 responses get neither a
+/// Content-Length nor a body. The buffer is grown at most once, and every
+/// byte is copied exactly once. Returns how many bytes were written.
+size_t write_response(mg_connection *conn, int status_code,
+                      std::span<const std::string_view> header_blocks,
+                      std::span<const std::string_view> body);
+
+/// What's known about a request once it's been answered, for the server to log
+/// (and whatever else) without having to dig through the response itself.
+/// The server fills in the handler, and the handlers fill in the rest.
+struct RequestContext {
+    // when the request was parsed
+    std::chrono::steady_clock::time_point started{};
+    // the route that matched, e.g. "GET /api/short"
+    std::string_view handler{};
+    int status_code{0};
+    // how much of the response was queued when the handler returned. for files
+    // that mongoose streams afterwards, that's only the headers.
+    size_t response_size{0};
+    // the request body mustn't end up in the logs
+    bool confidential{false};
+};
 
 struct HttpResponse {
     int status_code{200};
     std::unordered_map<std::string, std::string> headers{};
     std::string body{};
+    std::optional<ContentType> content_type{};
 
-    std::string header_string() const;
+    std::pmr::string header_string(std::pmr::memory_resource *arena) const;
+    void send(mg_connection *conn, RequestContext &ctx) const;
     void set_content_type(ContentType ct) {
-        headers["Content-Type"] = content_type_to_string(ct);
+        content_type = ct;
     }
 };
 
+/// Takes the response to a request once it's ready. It may be called from any
+/// thread, but only once.
+using Responder = std::function<void(HttpResponse)>;
+
 class BaseHandler {
   public:
-    virtual bool matches(const HttpMessage &msg) const = 0;
+    /// Called once, when the handler is registered.
+    virtual std::vector<Route> routes() const = 0;
+    /// Handlers that don't care who's asking should return false, so that
+    /// their requests never touch the session table.
+    inline virtual bool needs_user() const {
+        return true;
+    }
     inline virtual void handle(mg_connection *, Server &, const HttpMessage &) {
     }
     inline virtual void handle(mg_connection *conn, Server &server,
-                               const HttpMessage &msg, bool &) {
+                               const HttpMessage &msg, RequestContext &) {
         handle(conn, server, msg);
     }
     virtual ~BaseHandler() = default;
@@ -51,14 +90,22 @@ class BaseHandler {
 class SimpleHandler : public BaseHandler {
   public:
     void handle(mg_connection *conn, Server &server, const HttpMessage &msg,
-                bool &confidential) override final;
+                RequestContext &ctx) override final;
     inline virtual HttpResponse respond(Server &, const HttpMessage &) {
         return {};
     };
     inline virtual HttpResponse respond(Server &server, const HttpMessage &msg,
-                                        bool &) {
+                                        RequestContext &) {
         return respond(server, msg);
     }
+    /// Handlers that have to wait on a database write can override this
+    /// instead, and call `done` from the write's callback, so that the worker
+    /// thread is free to take other requests in the meantime. The message and
+    /// the context stay alive until `done` is called.
+    inline virtual void respond_async(Server &server, const HttpMessage &msg,
+                                      RequestContext &ctx, Responder done) {
+        done(respond(server, msg, ctx));
+    }
 };
 
 class DirHandler : public BaseHandler {
@@ -69,9 +116,12 @@ class DirHandler : public BaseHandler {
   public:
     DirHandler(const std::string &path_prefix, const std::string &root);
 
-    bool matches(const HttpMessage &msg) const override;
-    void handle(mg_connection *conn, Server &server,
-                const HttpMessage &msg) override;
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
+    void handle(mg_connection *conn, Server &server, const HttpMessage &msg,
+                RequestContext &ctx) override;
 };
 
 class FileHandler : public BaseHandler {
@@ -82,7 +132,10 @@ class FileHandler : public BaseHandler {
   public:
     FileHandler(const std::string &uri, const std::string &path);
 
-    bool matches(const HttpMessage &msg) const override;
-    void handle(mg_connection *conn, Server &server,
-                const HttpMessage &msg) override;
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
+    void handle(mg_connection *conn, Server &server, const HttpMessage &msg,
+                RequestContext &ctx) override;
 };
\ No newline at end of file
@@ -4,13 +4,13 @@
 #include <inja/inja.hpp>
 #include <nlohmann/json.hpp>
 
-using nlohmann::json;
+using nlohmann::json, std::vector;
 
 AboutHandler::AboutHandler() : m_temp{m_env.parse_template("about.html")} {
 }
 
-bool AboutHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/about";
+vector<Route> AboutHandler::routes() const {
+    return {{"GET", "/about"}};
 }
 
 HttpResponse AboutHandler::respond(Server &, const HttpMessage &msg) {
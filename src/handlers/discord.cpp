@@ -1,4 +1,5 @@
 #include "discord.hpp"
+#include "../jsonwriter.hpp"
 #include "../server.hpp"
 #include "../util.hpp"
 
@@ -18,8 +19,8 @@ DiscordHandler::DiscordHandler()
     : m_temp{m_env.parse_template("discord.html")} {
 }
 
-bool DiscordHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/discord_name";
+vector<Route> DiscordHandler::routes() const {
+    return {{"GET", "/discord_name"}};
 }
 
 HttpResponse DiscordHandler::respond(Server &, const HttpMessage &msg) {
@@ -66,14 +67,12 @@ DiscordApiGet::DiscordApiGet(const string &dictionary_file) {
     }
 }
 
-bool DiscordApiGet::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" &&
-           match<false>(msg.get_uri(), "/api/discord/*").has_value();
+vector<Route> DiscordApiGet::routes() const {
+    return {{"GET", "/api/discord/*"}};
 }
 
 HttpResponse DiscordApiGet::respond(Server &, const HttpMessage &msg) {
-    auto matches = match<true>(msg.get_uri(), "/api/discord/*");
-    string name{matches.value()[0]};
+    string name{msg.get_path_param()};
     trim(name);
 
     if(name.size() < 3 || name.size() > 50) {
@@ -84,13 +83,13 @@ HttpResponse DiscordApiGet::respond(Server &, const HttpMessage &msg) {
     }
 
     auto subsequences = find_subsequences(name, 1000);
-    json body{{"names", json::array()}};
-    for(const string &word : subsequences) {
-        body["names"].push_back(word);
-    }
-
     HttpResponse response{};
-    response.body = body.dump();
+    JsonWriter writer{response.body};
+    writer.begin_object().key("names").begin_array();
+    for(std::string_view word : subsequences) {
+        writer.value(word);
+    }
+    writer.end_array().end_object();
     response.set_content_type(ContentType::ApplicationJson);
     return response;
 }
@@ -125,10 +124,10 @@ static bool is_subsequence(const string &needle, const string &haystack) {
     return true;
 }
 
-vector<string> DiscordApiGet::find_subsequences(const string &haystack,
-                                                size_t limit) {
+vector<std::string_view> DiscordApiGet::find_subsequences(
+    const string &haystack, size_t limit) const {
     string canon = canonicalize(haystack);
-    vector<string> output{};
+    vector<std::string_view> output{};
 
     for(const string &needle : m_dictionary) {
         if(output.size() >= limit) {
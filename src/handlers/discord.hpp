@@ -11,7 +11,7 @@ class DiscordHandler : public SimpleHandler {
 
   public:
     DiscordHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
@@ -21,9 +21,13 @@ class DiscordApiGet : public SimpleHandler {
 
   public:
     DiscordApiGet(const std::string &dictionary_file);
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 
-    std::vector<std::string> find_subsequences(const std::string &word,
-                                               size_t limit);
+    /// The results point into the dictionary.
+    std::vector<std::string_view> find_subsequences(const std::string &word,
+                                                    size_t limit) const;
 };
\ No newline at end of file
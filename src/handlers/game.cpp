@@ -1,19 +1,21 @@
 #include "game.hpp"
+#include "../jsonreader.hpp"
+#include "../jsonwriter.hpp"
 #include "../server.hpp"
 #include "../util.hpp"
 
 #include <inja/inja.hpp>
 #include <nlohmann/json.hpp>
 
-using nlohmann::json, std::string;
+using nlohmann::json, std::string, std::vector;
 
 // GameHandler
 
 GameHandler::GameHandler() : m_temp{m_env.parse_template("game.html")} {
 }
 
-bool GameHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/game";
+vector<Route> GameHandler::routes() const {
+    return {{"GET", "/game"}};
 }
 
 HttpResponse GameHandler::respond(Server &, const HttpMessage &msg) {
@@ -31,82 +33,153 @@ HttpResponse GameHandler::respond(Server &, const HttpMessage &msg) {
 
 // GameApiGet
 
-bool GameApiGet::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/api/game";
+GameApiGet::GameApiGet() : m_epoch{now<std::chrono::milliseconds>()} {
 }
 
-HttpResponse GameApiGet::respond(Server &server, const HttpMessage &) {
+vector<Route> GameApiGet::routes() const {
+    return {{"GET", "/api/game"}};
+}
+
+// whether an If-None-Match header lists `etag` (or is "*")
+static bool etag_matches(std::string_view header, std::string_view etag) {
+    while(!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view candidate = header.substr(0, comma);
+        size_t start = candidate.find_first_not_of(" \t");
+        size_t end = candidate.find_last_not_of(" \t");
+        if(start != std::string_view::npos) {
+            candidate = candidate.substr(start, end - start + 1);
+            if(candidate == etag || candidate == "*") {
+                return true;
+            }
+        }
+        if(comma == std::string_view::npos) {
+            break;
+        }
+        header.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// must be called with m_mutex held
+bool GameApiGet::build_body(Server &server) {
+    // read before the query, so that a message committed in between makes
+    // the body look older than it is rather than newer
+    uint64_t version = server.get_db().get_messages_version();
     const auto messages{server.get_db().get_messages()};
     if(messages.is_err()) {
-        HttpResponse response{.status_code = 500};
-        response.body = R"({ "error": "database error" })";
-        response.set_content_type(ContentType::ApplicationJson);
-        return response;
+        return false;
     }
 
-    json data{{"messages", json::array()}};
+    m_body.clear();
+    JsonWriter writer{m_body};
+    writer.begin_object().key("messages").begin_array();
     for(const auto &message : messages.get_ok()) {
-        data["messages"].push_back({{"name", message.name},
-                                    {"content", message.content},
-                                    {"timestamp", message.timestamp}});
+        writer.begin_object()
+            .field("name", message.name)
+            .field("content", message.content)
+            .field("timestamp", message.timestamp)
+            .end_object();
+    }
+    writer.end_array().end_object();
+
+    m_version = version;
+    m_etag = '"' + std::to_string(m_epoch) + '-' + std::to_string(version) +
+             '"';
+    m_cached = true;
+    return true;
+}
+
+HttpResponse GameApiGet::respond(Server &server, const HttpMessage &msg) {
+    std::lock_guard lock{m_mutex};
+    if(!m_cached || m_version != server.get_db().get_messages_version()) {
+        if(!build_body(server)) {
+            m_cached = false;
+            HttpResponse response{.status_code = 500};
+            response.body = R"({ "error": "database error" })";
+            response.set_content_type(ContentType::ApplicationJson);
+            return response;
+        }
     }
 
     HttpResponse response{};
-    response.body = data.dump();
+    // browsers keep the body, but have to check that it's still current
+    response.headers["Cache-Control"] = "no-cache";
+    response.headers["ETag"] = m_etag;
+    auto if_none_match = msg.get_header("If-None-Match");
+    if(if_none_match.has_value() && etag_matches(*if_none_match, m_etag)) {
+        response.status_code = 304;
+        return response;
+    }
+
+    response.body = m_body;
     response.set_content_type(ContentType::ApplicationJson);
     return response;
 }
 
 // GameApiPost
 
-bool GameApiPost::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "POST" && msg.get_uri() == "/api/game";
+constexpr size_t MAX_NAME_LENGTH = 40;
+constexpr size_t MAX_CONTENT_LENGTH = 1000;
+
+vector<Route> GameApiPost::routes() const {
+    return {{"POST", "/api/game"}};
 }
 
-HttpResponse GameApiPost::respond(Server &server, const HttpMessage &msg) {
-    json data{json::parse(msg.get_body(), nullptr, false)};
-    if(data.is_discarded() ||
-       !(data.contains("name") && data["name"].is_string() &&
-         data.contains("content") && data["content"].is_string()))
-    {
-        HttpResponse response{.status_code = 400,
-                              .body = R"({"error": "invalid json"})"};
+void GameApiPost::respond_async(Server &server, const HttpMessage &msg,
+                                RequestContext &, Responder done) {
+    // the limits are checked again once the values have been trimmed
+    constexpr JsonField FIELDS[] = {
+        {"name", MAX_NAME_LENGTH + WHITESPACE_SLACK},
+        {"content", MAX_CONTENT_LENGTH + WHITESPACE_SLACK}};
+    std::string_view values[std::size(FIELDS)];
+    auto parsed =
+        extract_json_fields(msg.get_body(), FIELDS, values, msg.get_arena());
+    if(parsed.is_err()) {
+        HttpResponse response{.status_code = 400};
+        response.body = parsed.get_err() == JsonError::TooLong
+                            ? R"({"error": "invalid data size"})"
+                            : R"({"error": "invalid json"})";
         response.set_content_type(ContentType::ApplicationJson);
-        return response;
+        done(std::move(response));
+        return;
     }
 
-    string name{data["name"]};
+    string name{values[0]};
     trim(name);
 
-    string content{data["content"]};
+    string content{values[1]};
     trim(content);
 
-    if(name.size() < 1 || name.size() > 40 || content.size() < 1 ||
-       content.size() > 1000)
+    if(name.size() < 1 || name.size() > MAX_NAME_LENGTH || content.size() < 1 ||
+       content.size() > MAX_CONTENT_LENGTH)
     {
         HttpResponse response{.status_code = 400,
                               .body = R"({"error": "invalid data size"})"};
         response.set_content_type(ContentType::ApplicationJson);
-        return response;
+        done(std::move(response));
+        return;
     }
 
-    auto res = server.get_db().insert_message(
+    server.get_async_db().insert_message(
         Message{.name = name,
                 .content = content,
                 .timestamp = -1,
-                .ip = mg_ip_to_string(msg.get_peer_addr())});
-
-    HttpResponse response{};
-    if(res.is_err() && res.get_err() == DbError::Unique) {
-        response.status_code = 429;
-        response.body = R"({ "error": "Please don't spam!" })";
-    } else if(res.is_err()) {
-        response.status_code = 500;
-        response.body = R"({ "error": "database error" })";
-    } else {
-        response.status_code = 200;
-        response.body = R"({ "success": "Message submitted successfully." })";
-    }
-    response.set_content_type(ContentType::ApplicationJson);
-    return response;
+                .ip = mg_ip_to_string(msg.get_peer_addr())},
+        [done = std::move(done)](const DbResult<std::monostate> &res) {
+            HttpResponse response{};
+            if(res.is_err() && res.get_err() == DbError::Unique) {
+                response.status_code = 429;
+                response.body = R"({ "error": "Please don't spam!" })";
+            } else if(res.is_err()) {
+                response.status_code = 500;
+                response.body = R"({ "error": "database error" })";
+            } else {
+                response.status_code = 200;
+                response.body =
+                    R"({ "success": "Message submitted successfully." })";
+            }
+            response.set_content_type(ContentType::ApplicationJson);
+            done(std::move(response));
+        });
 }
\ No newline at end of file
@@ -4,6 +4,10 @@
 
 #include <inja/inja.hpp>
 
+#include <cstdint>
+#include <mutex>
+#include <string>
+
 class GameHandler : public SimpleHandler {
   private:
     inja::Environment m_env{"templates/"};
@@ -11,20 +15,41 @@ class GameHandler : public SimpleHandler {
 
   public:
     GameHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
 class GameApiGet : public SimpleHandler {
+  private:
+    // the last response body, and the message version it was built from.
+    // it's rebuilt (under the lock, so only once) when the version moves on.
+    std::mutex m_mutex{};
+    bool m_cached{false};
+    uint64_t m_version{0};
+    std::string m_body{};
+    std::string m_etag{};
+    // the version starts over with every run, so ETags from a previous run
+    // are told apart by when this one started
+    int64_t m_epoch;
+
+    bool build_body(Server &server);
+
   public:
-    GameApiGet() = default;
-    bool matches(const HttpMessage &msg) const override;
+    GameApiGet();
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
 class GameApiPost : public SimpleHandler {
   public:
     GameApiPost() = default;
-    bool matches(const HttpMessage &msg) const override;
-    HttpResponse respond(Server &server, const HttpMessage &msg) override;
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
+    void respond_async(Server &server, const HttpMessage &msg,
+                       RequestContext &ctx, Responder done) override;
 };
\ No newline at end of file
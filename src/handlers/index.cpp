@@ -1,5 +1,6 @@
 #include "index.hpp"
 #include "../server.hpp"
+#include "../util.hpp"
 
 #include <inja/inja.hpp>
 #include <nlohmann/json.hpp>
@@ -7,21 +8,26 @@
 IndexHandler::IndexHandler() : m_temp{m_env.parse_template("index.html")} {
 }
 
-bool IndexHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/";
+std::vector<Route> IndexHandler::routes() const {
+    return {{"GET", "/"}};
 }
 
 HttpResponse IndexHandler::respond(Server &server, const HttpMessage &msg) {
     nlohmann::json data{};
     data["title"] = "Home";
-    auto visitors{server.get_db().get_and_increase_visitors()};
-    if(visitors.is_err()) {
-        return HttpResponse{.status_code = 500};
-    }
-    data["visitors"] = visitors.get_ok();
+    // people who are logged in are told apart by name, so that they're only
+    // counted once wherever they visit from
+    std::string visitor{};
     if(msg.get_username().has_value()) {
         data["user"] = msg.get_username().value();
+        visitor = "user:" + msg.get_username().value();
+    } else {
+        visitor = "addr:" + mg_ip_to_string(msg.get_peer_addr());
     }
+    auto visit = server.get_visitors().visit(visitor);
+    data["visitors"] = visit.visitors;
+    data["unique_today"] = visit.unique_today;
+    data["unique_all_time"] = visit.unique_all_time;
 
     HttpResponse response{};
     response.body = m_env.render(m_temp, data);
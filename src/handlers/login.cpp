@@ -8,7 +8,7 @@
 #include <memory>
 #include <sstream>
 
-using nlohmann::json, std::string, std::stringstream;
+using nlohmann::json, std::string, std::stringstream, std::vector;
 
 // LoginGetHandler
 
@@ -16,8 +16,8 @@ LoginGetHandler::LoginGetHandler()
     : m_temp{m_env.parse_template("login.html")} {
 }
 
-bool LoginGetHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/login";
+vector<Route> LoginGetHandler::routes() const {
+    return {{"GET", "/login"}};
 }
 
 HttpResponse LoginGetHandler::respond(Server &, const HttpMessage &msg) {
@@ -46,19 +46,20 @@ LoginPostHandler::LoginPostHandler(Server &server)
     server.register_cleanup(m_addr_ratelimit);
 }
 
-bool LoginPostHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "POST" && msg.get_uri() == "/login";
+vector<Route> LoginPostHandler::routes() const {
+    return {{"POST", "/login"}};
 }
 
-HttpResponse LoginPostHandler::respond(Server &server, const HttpMessage &msg,
-                                       bool &confidential) {
-    confidential = true;
+void LoginPostHandler::respond_async(Server &server, const HttpMessage &msg,
+                                     RequestContext &ctx, Responder done) {
+    ctx.confidential = true;
     HttpResponse response{};
 
     if(msg.get_username().has_value()) {
         response.status_code = 302;
         response.headers["Location"] = "/";
-        return response;
+        done(std::move(response));
+        return;
     }
 
     response.set_content_type(ContentType::TextHtml);
@@ -67,7 +68,8 @@ HttpResponse LoginPostHandler::respond(Server &server, const HttpMessage &msg,
         response.status_code = 429;
         response.body = m_env.render(
             m_temp, {{"title", "Login"}, {"error", "Please try again later."}});
-        return response;
+        done(std::move(response));
+        return;
     }
 
     auto username_r = msg.get_form_var("username");
@@ -78,7 +80,8 @@ HttpResponse LoginPostHandler::respond(Server &server, const HttpMessage &msg,
         response.body = m_env.render(
             m_temp, {{"title", "Login"},
                      {"error", "Please enter a username and a password."}});
-        return response;
+        done(std::move(response));
+        return;
     }
 
     string username{username_r.value()}, password{password_r.value()};
@@ -86,7 +89,8 @@ HttpResponse LoginPostHandler::respond(Server &server, const HttpMessage &msg,
         response.body =
             m_env.render(m_temp, {{"title", "Login"},
                                   {"error", "Invalid username or password."}});
-        return response;
+        done(std::move(response));
+        return;
     }
 
     auto user_exists = server.get_db().user_exists(username);
@@ -94,41 +98,57 @@ HttpResponse LoginPostHandler::respond(Server &server, const HttpMessage &msg,
         response.body =
             m_env.render(m_temp, {{"title", "Login"},
                                   {"error", "Invalid username or password."}});
-        return response;
+        done(std::move(response));
+        return;
     } else if(!m_username_ratelimit->attempt(username)) {
         response.status_code = 429;
         response.body = m_env.render(
             m_temp, {{"title", "Login"}, {"error", "Please try again later."}});
-        return response;
+        done(std::move(response));
+        return;
     }
 
-    auto auth_r = server.get_auth().login(username, password);
-    if(auth_r.is_err()) {
-        response.body =
-            m_env.render(m_temp, {{"title", "Login"},
-                                  {"error", "Invalid username or password."}});
-        return response;
-    }
-
-    Token token = auth_r.get_ok();
-    response.status_code = 302;
-    response.headers["Location"] = "/";
-
-    stringstream setcookie{};
-    setcookie << "id=" << token.to_string()
-              << "; Secure; HttpOnly; SameSite=Lax; Max-Age="
-              << TOKEN_LIFE_SECONDS;
-    response.headers["Set-Cookie"] = setcookie.str();
-
-    return response;
+    // the rest happens once the session has been stored
+    server.get_auth().login(
+        username, password,
+        [this, response = std::move(response),
+         done = std::move(done)](const Result<Token, string> &auth_r) mutable {
+            if(auth_r.is_err()) {
+                response.body = m_env.render(
+                    m_temp, {{"title", "Login"},
+                             {"error", "Invalid username or password."}});
+                done(std::move(response));
+                return;
+            }
+
+            const Token &token = auth_r.get_ok();
+            response.status_code = 302;
+            response.headers["Location"] = "/";
+
+            stringstream setcookie{};
+            setcookie << "id=" << token.to_string()
+                      << "; Secure; HttpOnly; SameSite=Lax; Max-Age="
+                      << TOKEN_LIFE_SECONDS;
+            response.headers["Set-Cookie"] = setcookie.str();
+
+            done(std::move(response));
+        });
 }
 
 // LogoutHandler
 
-bool LogoutHandler::matches(const HttpMessage &msg) const {
-    return msg.get_uri() == "/logout";
-};
-HttpResponse LogoutHandler::respond(Server &, const HttpMessage &) {
+vector<Route> LogoutHandler::routes() const {
+    return {{"", "/logout"}};
+}
+HttpResponse LogoutHandler::respond(Server &server, const HttpMessage &msg) {
+    auto id = msg.get_id_cookie();
+    if(id.has_value()) {
+        auto token_r = Token::parse(*id);
+        if(token_r.is_ok()) {
+            server.get_auth().logout(token_r.get_ok());
+        }
+    }
+
     HttpResponse response{.status_code = 302};
     response.headers["Location"] = "/";
     response.headers["Set-Cookie"] = "id=invalid; Max-Age=0";
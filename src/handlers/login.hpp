@@ -12,7 +12,7 @@ class LoginGetHandler : public SimpleHandler {
 
   public:
     LoginGetHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
@@ -25,14 +25,17 @@ class LoginPostHandler : public SimpleHandler {
 
   public:
     LoginPostHandler(Server &server);
-    bool matches(const HttpMessage &msg) const override;
-    HttpResponse respond(Server &server, const HttpMessage &msg,
-                         bool &confidential) override;
+    std::vector<Route> routes() const override;
+    void respond_async(Server &server, const HttpMessage &msg,
+                       RequestContext &ctx, Responder done) override;
 };
 
 class LogoutHandler : public SimpleHandler {
   public:
     LogoutHandler() = default;
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
\ No newline at end of file
@@ -6,15 +6,15 @@
 
 #include <optional>
 
-using nlohmann::json, std::string, std::optional;
+using nlohmann::json, std::string, std::string_view, std::optional, std::vector;
 
 // OgHandler
 
 OgHandler::OgHandler() : m_temp{m_env.parse_template("og.html")} {
 }
 
-bool OgHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/og";
+vector<Route> OgHandler::routes() const {
+    return {{"GET", "/og"}};
 }
 
 // title type url image description
@@ -32,7 +32,7 @@ HttpResponse OgHandler::respond(Server &, const HttpMessage &msg) {
     auto image = msg.get_query_var("image");
     auto description = msg.get_query_var("description");
 
-    constexpr auto test = [](const optional<string> &x) {
+    constexpr auto test = [](const optional<string_view> &x) {
         return x.has_value() && x->size() > 0 && x->size() <= 350;
     };
 
@@ -11,6 +11,6 @@ class OgHandler : public SimpleHandler {
 
   public:
     OgHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
\ No newline at end of file
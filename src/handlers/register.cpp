@@ -1,4 +1,5 @@
 #include "register.hpp"
+#include "../jsonwriter.hpp"
 #include "../server.hpp"
 #include "../util.hpp"
 
@@ -6,7 +7,7 @@
 #include <nlohmann/json.hpp>
 #include <sstream>
 
-using nlohmann::json, std::string, std::stringstream;
+using nlohmann::json, std::string, std::stringstream, std::vector;
 
 static bool is_admin(const HttpMessage &msg) {
     return is_localhost(msg.get_peer_addr());
@@ -18,8 +19,8 @@ RegisterGetHandler::RegisterGetHandler()
     : m_temp{m_env.parse_template("register.html")} {
 }
 
-bool RegisterGetHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/register";
+vector<Route> RegisterGetHandler::routes() const {
+    return {{"GET", "/register"}};
 }
 
 HttpResponse RegisterGetHandler::respond(Server &, const HttpMessage &msg) {
@@ -48,14 +49,14 @@ RegisterPostHandler::RegisterPostHandler()
     : m_temp{m_env.parse_template("register.html")} {
 }
 
-bool RegisterPostHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "POST" && msg.get_uri() == "/register";
+vector<Route> RegisterPostHandler::routes() const {
+    return {{"POST", "/register"}};
 }
 
 HttpResponse RegisterPostHandler::respond(Server &server,
                                           const HttpMessage &msg,
-                                          bool &confidential) {
-    confidential = true;
+                                          RequestContext &ctx) {
+    ctx.confidential = true;
 
     if(msg.get_username().has_value()) {
         HttpResponse response{.status_code = 302};
@@ -106,15 +107,13 @@ HttpResponse RegisterPostHandler::respond(Server &server,
 
 // GenerateTokenApiHandler
 
-bool GenerateRegistrationTokenApiHandler::matches(
-    const HttpMessage &msg) const {
-    return msg.get_method() == "POST" &&
-           msg.get_uri() == "/api/generate_registration_token";
+vector<Route> GenerateRegistrationTokenApiHandler::routes() const {
+    return {{"POST", "/api/generate_registration_token"}};
 }
 
 HttpResponse GenerateRegistrationTokenApiHandler::respond(
-    Server &server, const HttpMessage &msg, bool &confidential) {
-    confidential = true;
+    Server &server, const HttpMessage &msg, RequestContext &ctx) {
+    ctx.confidential = true;
 
     HttpResponse response{};
     response.set_content_type(ContentType::ApplicationJson);
@@ -128,10 +127,16 @@ HttpResponse GenerateRegistrationTokenApiHandler::respond(
     auto token = server.get_auth().generate_registration_token();
     if(token.is_err()) {
         response.status_code = 500;
-        response.body = json{{"error", token.get_err()}}.dump();
+        JsonWriter(response.body)
+            .begin_object()
+            .field("error", token.get_err())
+            .end_object();
     } else {
         response.status_code = 200;
-        response.body = json{{"token", token.get_ok().to_string()}}.dump();
+        JsonWriter(response.body)
+            .begin_object()
+            .field("token", token.get_ok().to_string())
+            .end_object();
     }
     return response;
 }
\ No newline at end of file
@@ -11,7 +11,7 @@ class RegisterGetHandler : public SimpleHandler {
 
   public:
     RegisterGetHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
@@ -22,15 +22,15 @@ class RegisterPostHandler : public SimpleHandler {
 
   public:
     RegisterPostHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg,
-                         bool &confidential) override;
+                         RequestContext &ctx) override;
 };
 
 class GenerateRegistrationTokenApiHandler : public SimpleHandler {
   public:
     GenerateRegistrationTokenApiHandler() = default;
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg,
-                         bool &confidential) override;
+                         RequestContext &ctx) override;
 };
\ No newline at end of file
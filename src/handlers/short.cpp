@@ -1,4 +1,6 @@
 #include "short.hpp"
+#include "../jsonreader.hpp"
+#include "../jsonwriter.hpp"
 #include "../server.hpp"
 #include "../util.hpp"
 
@@ -7,15 +9,15 @@
 
 #include <random>
 
-using nlohmann::json, std::string;
+using nlohmann::json, std::string, std::vector;
 
 // ShortHandler
 
 ShortHandler::ShortHandler() : m_temp{m_env.parse_template("short.html")} {
 }
 
-bool ShortHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/short";
+vector<Route> ShortHandler::routes() const {
+    return {{"GET", "/short"}};
 }
 
 HttpResponse ShortHandler::respond(Server &, const HttpMessage &msg) {
@@ -37,15 +39,13 @@ HttpResponse ShortHandler::respond(Server &, const HttpMessage &msg) {
 
 // ShortNavigateHandler
 
-bool ShortNavigateHandler::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" &&
-           match<false>(msg.get_uri(), "/s/*").has_value();
+vector<Route> ShortNavigateHandler::routes() const {
+    return {{"GET", "/s/*"}};
 }
 
 HttpResponse ShortNavigateHandler::respond(Server &server,
                                            const HttpMessage &msg) {
-    auto matches = match<true>(msg.get_uri(), "/s/*");
-    string mnemonic = matches.value()[0];
+    string mnemonic{msg.get_path_param()};
 
     auto link = server.get_db().get_short_link(mnemonic);
     HttpResponse response{};
@@ -65,8 +65,8 @@ HttpResponse ShortNavigateHandler::respond(Server &server,
 
 // ShortApiGet
 
-bool ShortApiGet::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "GET" && msg.get_uri() == "/api/short";
+vector<Route> ShortApiGet::routes() const {
+    return {{"GET", "/api/short"}};
 }
 
 HttpResponse ShortApiGet::respond(Server &server, const HttpMessage &msg) {
@@ -85,19 +85,25 @@ HttpResponse ShortApiGet::respond(Server &server, const HttpMessage &msg) {
         return response;
     }
 
-    json data{{"links", json::array()}};
+    JsonWriter writer{response.body};
+    writer.begin_object().key("links").begin_array();
     for(const auto &[mnemonic, link] : links.get_ok()) {
-        data["links"].push_back({{"mnemonic", mnemonic}, {"link", link}});
+        writer.begin_object()
+            .field("mnemonic", mnemonic)
+            .field("link", link)
+            .end_object();
     }
+    writer.end_array().end_object();
     response.status_code = 200;
-    response.body = data.dump();
     return response;
 }
 
 // ShortApiPost
 
-bool ShortApiPost::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "POST" && msg.get_uri() == "/api/short";
+constexpr size_t MAX_LINK_LENGTH = 1500;
+
+vector<Route> ShortApiPost::routes() const {
+    return {{"POST", "/api/short"}};
 }
 
 // there are 7 chars with 63 choices each. this means that the total number of
@@ -120,25 +126,33 @@ static string generate_mnemonic() {
     return output;
 }
 
-HttpResponse ShortApiPost::respond(Server &server, const HttpMessage &msg) {
+void ShortApiPost::respond_async(Server &server, const HttpMessage &msg,
+                                 RequestContext &, Responder done) {
     HttpResponse response{};
     response.set_content_type(ContentType::ApplicationJson);
     if(!msg.get_username().has_value()) {
         response.status_code = 403;
         response.body = R"({"error": "you are not logged in"})";
-        return response;
+        done(std::move(response));
+        return;
     }
 
-    json data{json::parse(msg.get_body(), nullptr, false)};
-    if(data.is_discarded() ||
-       !(data.contains("link") && data["link"].is_string()))
-    {
+    // the limit is checked again once the link has been trimmed
+    constexpr JsonField FIELDS[] = {
+        {"link", MAX_LINK_LENGTH + WHITESPACE_SLACK}};
+    std::string_view values[std::size(FIELDS)];
+    auto parsed =
+        extract_json_fields(msg.get_body(), FIELDS, values, msg.get_arena());
+    if(parsed.is_err()) {
         response.status_code = 400;
-        response.body = R"({"error": "invalid json"})";
-        return response;
+        response.body = parsed.get_err() == JsonError::TooLong
+                            ? R"({"error": "invalid link"})"
+                            : R"({"error": "invalid json"})";
+        done(std::move(response));
+        return;
     }
 
-    string link = data["link"];
+    string link{values[0]};
     trim(link);
 
     // there is very little point to fully validate that this is a correct URL.
@@ -146,35 +160,42 @@ HttpResponse ShortApiPost::respond(Server &server, const HttpMessage &msg) {
     // being redirected, but also this API is just not open to the general
     // public. if this were a widely used link shortening service, it would be
     // a very different situation.
-    if(link.size() < 1 || link.size() > 1500 ||
+    if(link.size() < 1 || link.size() > MAX_LINK_LENGTH ||
        !(link.starts_with("http://") || link.starts_with("https://")))
     {
         response.status_code = 400;
         response.body = R"({"error": "invalid link"})";
-        return response;
+        done(std::move(response));
+        return;
     }
 
     string mnemonic = generate_mnemonic();
-    auto res = server.get_db().insert_short_link(msg.get_username().value(),
-                                                 mnemonic, link);
-    if(res.is_err() && res.get_err() == DbError::Unique) {
-        // incredibly unlikely
-        response.status_code = 500;
-        response.body = R"({"error": "please try again"})";
-    } else if(res.is_err()) {
-        response.status_code = 500;
-        response.body = R"({"error": "DB error"})";
-    } else {
-        response.status_code = 200;
-        response.body = json{{"mnemonic", mnemonic}}.dump();
-    }
-    return response;
+    server.get_async_db().insert_short_link(
+        msg.get_username().value(), mnemonic, link,
+        [response = std::move(response), mnemonic,
+         done = std::move(done)](const DbResult<std::monostate> &res) mutable {
+            if(res.is_err() && res.get_err() == DbError::Unique) {
+                // incredibly unlikely
+                response.status_code = 500;
+                response.body = R"({"error": "please try again"})";
+            } else if(res.is_err()) {
+                response.status_code = 500;
+                response.body = R"({"error": "DB error"})";
+            } else {
+                response.status_code = 200;
+                JsonWriter(response.body)
+                    .begin_object()
+                    .field("mnemonic", mnemonic)
+                    .end_object();
+            }
+            done(std::move(response));
+        });
 }
 
 // ShortApiDelete
 
-bool ShortApiDelete::matches(const HttpMessage &msg) const {
-    return msg.get_method() == "DELETE" && msg.get_uri() == "/api/short";
+vector<Route> ShortApiDelete::routes() const {
+    return {{"DELETE", "/api/short"}};
 }
 HttpResponse ShortApiDelete::respond(Server &server, const HttpMessage &msg) {
     HttpResponse response{};
@@ -185,16 +206,22 @@ HttpResponse ShortApiDelete::respond(Server &server, const HttpMessage &msg) {
         return response;
     }
 
-    json data{json::parse(msg.get_body(), nullptr, false)};
-    if(data.is_discarded() ||
-       !(data.contains("mnemonic") && data["mnemonic"].is_string()))
-    {
+    // no real mnemonic is anywhere near this long
+    constexpr JsonField FIELDS[] = {{"mnemonic", 64}};
+    std::string_view values[std::size(FIELDS)];
+    auto parsed =
+        extract_json_fields(msg.get_body(), FIELDS, values, msg.get_arena());
+    if(parsed.is_err()) {
+        // a mnemonic that's too long can't exist, so it gets the same answer
+        // as any other one that doesn't
         response.status_code = 400;
-        response.body = R"({"error": "invalid json"})";
+        response.body = parsed.get_err() == JsonError::TooLong
+                            ? R"({"error": "invalid mnemonic or username"})"
+                            : R"({"error": "invalid json"})";
         return response;
     }
 
-    string mnemonic = data["mnemonic"];
+    string mnemonic{values[0]};
 
     auto res =
         server.get_db().delete_short_link(msg.get_username().value(), mnemonic);
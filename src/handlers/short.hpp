@@ -11,34 +11,38 @@ class ShortHandler : public SimpleHandler {
 
   public:
     ShortHandler();
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
 class ShortNavigateHandler : public SimpleHandler {
   public:
     ShortNavigateHandler() = default;
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
+    inline bool needs_user() const override {
+        return false;
+    }
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
 class ShortApiGet : public SimpleHandler {
   public:
     ShortApiGet() = default;
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
 
 class ShortApiPost : public SimpleHandler {
   public:
     ShortApiPost() = default;
-    bool matches(const HttpMessage &msg) const override;
-    HttpResponse respond(Server &server, const HttpMessage &msg) override;
+    std::vector<Route> routes() const override;
+    void respond_async(Server &server, const HttpMessage &msg,
+                       RequestContext &ctx, Responder done) override;
 };
 
 class ShortApiDelete : public SimpleHandler {
   public:
     ShortApiDelete() = default;
-    bool matches(const HttpMessage &msg) const override;
+    std::vector<Route> routes() const override;
     HttpResponse respond(Server &server, const HttpMessage &msg) override;
 };
\ No newline at end of file
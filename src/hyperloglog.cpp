@@ -0,0 +1,65 @@
+#include "hyperloglog.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+// FNV-1a, followed by the splitmix64 finalizer so that every bit of the
+// result depends on every bit of the input
+static uint64_t hash(std::string_view item) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for(char ch : item) {
+        hash = (hash ^ (uint8_t)ch) * 0x100000001b3;
+    }
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+    return hash ^ (hash >> 31);
+}
+
+bool HyperLogLog::add(std::string_view item) {
+    uint64_t h = hash(item);
+    // the top bits pick the register, and the rest decide the rank. the rank
+    // is capped, since the low bits run out eventually.
+    size_t index = h >> (64 - PRECISION);
+    uint64_t rest = h << PRECISION;
+    uint8_t rank = std::min(std::countl_zero(rest), 64 - PRECISION) + 1;
+
+    if(rank <= m_registers[index]) {
+        return false;
+    }
+    m_registers[index] = rank;
+    return true;
+}
+
+uint64_t HyperLogLog::estimate() const {
+    constexpr double m = REGISTERS;
+    constexpr double alpha = 0.7213 / (1 + 1.079 / m);
+
+    double sum = 0;
+    size_t zeroes = 0;
+    for(uint8_t reg : m_registers) {
+        sum += std::ldexp(1.0, -reg);
+        zeroes += reg == 0;
+    }
+    double estimate = alpha * m * m / sum;
+
+    // small cardinalities are estimated much better by counting the registers
+    // that were never touched
+    if(estimate <= 2.5 * m && zeroes > 0) {
+        estimate = m * std::log(m / zeroes);
+    }
+    return (uint64_t)std::llround(estimate);
+}
+
+void HyperLogLog::clear() {
+    m_registers.fill(0);
+}
+
+bool HyperLogLog::load(std::span<const uint8_t> data) {
+    if(data.size() != m_registers.size()) {
+        return false;
+    }
+    std::memcpy(m_registers.data(), data.data(), data.size());
+    return true;
+}
\ No newline at end of file
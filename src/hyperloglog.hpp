@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+/// Estimates how many distinct items it has seen, in a fixed 4 KiB and to
+/// within about 1.6%. Items are never stored, only their hashes' leading
+/// zeroes, so nothing about them can be recovered later.
+///
+/// This isn't thread-safe.
+class HyperLogLog {
+  public:
+    // 2^12 registers
+    static constexpr int PRECISION = 12;
+    static constexpr size_t REGISTERS = size_t{1} << PRECISION;
+
+  private:
+    std::array<uint8_t, REGISTERS> m_registers{};
+
+  public:
+    /// Returns whether the estimate may have changed.
+    bool add(std::string_view item);
+    uint64_t estimate() const;
+    void clear();
+
+    /// The raw registers, for storing the sketch.
+    inline std::span<const uint8_t> data() const {
+        return m_registers;
+    }
+    /// Restores a sketch from its registers. Returns false (and leaves the
+    /// sketch as it was) if they're the wrong size.
+    bool load(std::span<const uint8_t> data);
+};
\ No newline at end of file
@@ -0,0 +1,420 @@
+#include "jsonreader.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+using std::string_view, std::span;
+
+// arrays and objects nested deeper than this are rejected
+constexpr int MAX_DEPTH = 16;
+// no field has a longer key than this, so longer keys are never unescaped
+constexpr size_t MAX_KEY_LENGTH = 64;
+
+static int hex_digit(char ch) {
+    if('0' <= ch && ch <= '9') {
+        return ch - '0';
+    } else if('a' <= ch && ch <= 'f') {
+        return ch - 'a' + 10;
+    } else if('A' <= ch && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+// reads the 4 hex digits of a \u escape that starts at `pos`
+static bool read_code_unit(string_view input, size_t pos, uint32_t &unit) {
+    if(pos + 6 > input.size() || input[pos] != '\\' || input[pos + 1] != 'u') {
+        return false;
+    }
+    unit = 0;
+    for(size_t i = pos + 2; i < pos + 6; i++) {
+        int digit = hex_digit(input[i]);
+        if(digit < 0) {
+            return false;
+        }
+        unit = unit * 16 + digit;
+    }
+    return true;
+}
+
+static size_t utf8_length(uint32_t cp) {
+    return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+}
+
+static char *encode_utf8(uint32_t cp, char *out) {
+    if(cp < 0x80) {
+        *out++ = (char)cp;
+    } else if(cp < 0x800) {
+        *out++ = (char)(0xc0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3f));
+    } else if(cp < 0x10000) {
+        *out++ = (char)(0xe0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (cp & 0x3f));
+    } else {
+        *out++ = (char)(0xf0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (cp & 0x3f));
+    }
+    return out;
+}
+
+// reads the \u escape (or surrogate pair) at `pos`, and returns how many
+// characters it took up, or 0 if it's invalid
+static size_t read_unicode_escape(string_view input, size_t pos,
+                                  uint32_t &cp) {
+    if(!read_code_unit(input, pos, cp)) {
+        return 0;
+    }
+    if(cp >= 0xdc00 && cp <= 0xdfff) {
+        return 0;
+    }
+    if(cp < 0xd800 || cp > 0xdbff) {
+        return 6;
+    }
+
+    uint32_t low{};
+    if(!read_code_unit(input, pos + 6, low) || low < 0xdc00 || low > 0xdfff) {
+        return 0;
+    }
+    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+    return 12;
+}
+
+// `raw` must have been validated already, and `out` must have room for its
+// unescaped length
+static void unescape(string_view raw, char *out) {
+    size_t i = 0;
+    while(i < raw.size()) {
+        if(raw[i] != '\\') {
+            *out++ = raw[i++];
+            continue;
+        }
+
+        char escape = raw[i + 1];
+        if(escape == 'u') {
+            uint32_t cp{};
+            i += read_unicode_escape(raw, i, cp);
+            out = encode_utf8(cp, out);
+            continue;
+        }
+        switch(escape) {
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        default:
+            // quotes and slashes
+            *out++ = escape;
+        }
+        i += 2;
+    }
+}
+
+namespace {
+
+class Parser {
+  private:
+    string_view m_input;
+    size_t m_pos{0};
+    JsonError m_error{JsonError::Syntax};
+
+    inline bool fail(JsonError error) {
+        m_error = error;
+        return false;
+    }
+
+    void skip_whitespace() {
+        while(m_pos < m_input.size() &&
+              (m_input[m_pos] == ' ' || m_input[m_pos] == '\t' ||
+               m_input[m_pos] == '\n' || m_input[m_pos] == '\r'))
+        {
+            m_pos++;
+        }
+    }
+
+    int peek() {
+        skip_whitespace();
+        return m_pos < m_input.size() ? (unsigned char)m_input[m_pos] : -1;
+    }
+
+    bool consume(char ch) {
+        if(peek() != (unsigned char)ch) {
+            return false;
+        }
+        m_pos++;
+        return true;
+    }
+
+    bool scan_string(size_t max_length, string_view &raw, size_t &length,
+                     bool &escaped);
+    bool skip_literal(string_view literal);
+    bool skip_number();
+    bool skip_value(int depth);
+
+  public:
+    inline explicit Parser(string_view input) : m_input{input} {
+    }
+
+    bool parse(span<const JsonField> fields, span<string_view> values,
+               std::pmr::memory_resource *arena);
+
+    inline JsonError get_error() const {
+        return m_error;
+    }
+};
+
+} // namespace
+
+// scans a string (starting at its opening quote) without unescaping it. `raw`
+// is set to whatever is between the quotes, and `length` to how long that is
+// once unescaped.
+bool Parser::scan_string(size_t max_length, string_view &raw, size_t &length,
+                         bool &escaped) {
+    if(!consume('"')) {
+        return fail(JsonError::Syntax);
+    }
+
+    size_t start = m_pos;
+    length = 0;
+    escaped = false;
+    while(true) {
+        if(m_pos >= m_input.size()) {
+            return fail(JsonError::Syntax);
+        }
+
+        unsigned char ch = m_input[m_pos];
+        if(ch == '"') {
+            raw = m_input.substr(start, m_pos - start);
+            m_pos++;
+            return true;
+        } else if(ch < 0x20) {
+            return fail(JsonError::Syntax);
+        } else if(ch == '\\') {
+            escaped = true;
+            char escape =
+                m_pos + 1 < m_input.size() ? m_input[m_pos + 1] : '\0';
+            if(escape == 'u') {
+                uint32_t cp{};
+                size_t len = read_unicode_escape(m_input, m_pos, cp);
+                if(len == 0) {
+                    return fail(JsonError::Syntax);
+                }
+                m_pos += len;
+                length += utf8_length(cp);
+            } else if(escape != '\0' && std::strchr("\"\\/bfnrt", escape)) {
+                m_pos += 2;
+                length += 1;
+            } else {
+                return fail(JsonError::Syntax);
+            }
+        } else if(ch >= 0x80) {
+            size_t len = utf8_sequence_length(m_input.substr(m_pos));
+            if(len == 0) {
+                return fail(JsonError::Syntax);
+            }
+            m_pos += len;
+            length += len;
+        } else {
+            m_pos++;
+            length++;
+        }
+
+        if(length > max_length) {
+            return fail(JsonError::TooLong);
+        }
+    }
+}
+
+bool Parser::skip_literal(string_view literal) {
+    if(m_input.substr(m_pos, literal.size()) != literal) {
+        return fail(JsonError::Syntax);
+    }
+    m_pos += literal.size();
+    return true;
+}
+
+bool Parser::skip_number() {
+    auto digits = [this] {
+        size_t start = m_pos;
+        while(m_pos < m_input.size() && '0' <= m_input[m_pos] &&
+              m_input[m_pos] <= '9')
+        {
+            m_pos++;
+        }
+        return m_pos > start;
+    };
+    auto next_is = [this](char ch) {
+        if(m_pos < m_input.size() && m_input[m_pos] == ch) {
+            m_pos++;
+            return true;
+        }
+        return false;
+    };
+
+    next_is('-');
+    if(!next_is('0') && !digits()) {
+        return fail(JsonError::Syntax);
+    }
+    if(next_is('.') && !digits()) {
+        return fail(JsonError::Syntax);
+    }
+    if(next_is('e') || next_is('E')) {
+        next_is('+') || next_is('-');
+        if(!digits()) {
+            return fail(JsonError::Syntax);
+        }
+    }
+    return true;
+}
+
+bool Parser::skip_value(int depth) {
+    if(depth > MAX_DEPTH) {
+        return fail(JsonError::TooDeep);
+    }
+
+    int ch = peek();
+    if(ch == '"') {
+        string_view raw{};
+        size_t length{};
+        bool escaped{};
+        return scan_string(SIZE_MAX, raw, length, escaped);
+    } else if(ch == '{') {
+        m_pos++;
+        if(consume('}')) {
+            return true;
+        }
+        do {
+            string_view raw{};
+            size_t length{};
+            bool escaped{};
+            if(peek() != '"' || !scan_string(SIZE_MAX, raw, length, escaped)) {
+                return fail(JsonError::Syntax);
+            }
+            if(!consume(':') || !skip_value(depth + 1)) {
+                return false;
+            }
+        } while(consume(','));
+        return consume('}') || fail(JsonError::Syntax);
+    } else if(ch == '[') {
+        m_pos++;
+        if(consume(']')) {
+            return true;
+        }
+        do {
+            if(!skip_value(depth + 1)) {
+                return false;
+            }
+        } while(consume(','));
+        return consume(']') || fail(JsonError::Syntax);
+    } else if(ch == 't') {
+        return skip_literal("true");
+    } else if(ch == 'f') {
+        return skip_literal("false");
+    } else if(ch == 'n') {
+        return skip_literal("null");
+    } else if(ch == '-' || ('0' <= ch && ch <= '9')) {
+        return skip_number();
+    }
+    return fail(JsonError::Syntax);
+}
+
+bool Parser::parse(span<const JsonField> fields, span<string_view> values,
+                   std::pmr::memory_resource *arena) {
+    // one bit per field
+    uint64_t found = 0;
+    if(fields.size() > 64) {
+        return fail(JsonError::Syntax);
+    }
+
+    if(!consume('{')) {
+        return fail(JsonError::Syntax);
+    }
+    if(!consume('}')) {
+        do {
+            string_view key{};
+            size_t key_length{};
+            bool key_escaped{};
+            if(peek() != '"' ||
+               !scan_string(SIZE_MAX, key, key_length, key_escaped))
+            {
+                return fail(JsonError::Syntax);
+            }
+            if(!consume(':')) {
+                return fail(JsonError::Syntax);
+            }
+
+            char key_buf[MAX_KEY_LENGTH];
+            if(key_escaped && key_length <= MAX_KEY_LENGTH) {
+                unescape(key, key_buf);
+                key = string_view(key_buf, key_length);
+            }
+
+            size_t index = 0;
+            while(index < fields.size() && fields[index].key != key) {
+                index++;
+            }
+            if(index == fields.size()) {
+                if(!skip_value(1)) {
+                    return false;
+                }
+                continue;
+            }
+
+            if(peek() != '"') {
+                return fail(JsonError::WrongType);
+            }
+            string_view raw{};
+            size_t length{};
+            bool escaped{};
+            if(!scan_string(fields[index].max_length, raw, length, escaped)) {
+                return false;
+            }
+            if(escaped) {
+                char *buf = (char *)arena->allocate(length, 1);
+                unescape(raw, buf);
+                raw = string_view(buf, length);
+            }
+            values[index] = raw;
+            found |= (uint64_t)1 << index;
+        } while(consume(','));
+
+        if(!consume('}')) {
+            return fail(JsonError::Syntax);
+        }
+    }
+
+    skip_whitespace();
+    if(m_pos != m_input.size()) {
+        return fail(JsonError::Syntax);
+    }
+    uint64_t all = fields.size() == 64 ? UINT64_MAX
+                                       : ((uint64_t)1 << fields.size()) - 1;
+    if(found != all) {
+        return fail(JsonError::Missing);
+    }
+    return true;
+}
+
+Result<std::monostate, JsonError>
+extract_json_fields(string_view body, span<const JsonField> fields,
+                    span<string_view> values,
+                    std::pmr::memory_resource *arena) {
+    Parser parser{body};
+    if(!parser.parse(fields, values, arena)) {
+        return {parser.get_error(), Err};
+    }
+    return {std::monostate{}, Ok};
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "util.hpp"
+
+#include <cstddef>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+#include <variant>
+
+/// A string field that a JSON body is expected to have.
+struct JsonField {
+    std::string_view key;
+    // the longest value (in bytes, once unescaped) that's accepted
+    size_t max_length;
+};
+
+/// How much surrounding whitespace a field may have on top of its own limit.
+/// Fields whose values are trimmed afterwards should be extracted with this
+/// much slack, and have their real limit checked once they've been trimmed.
+constexpr size_t WHITESPACE_SLACK = 1024;
+
+enum class JsonError {
+    // The body wasn't valid JSON, or wasn't an object
+    Syntax,
+    // Something was nested too deeply
+    TooDeep,
+    // One of the fields was longer than its limit
+    TooLong,
+    // One of the fields was missing
+    Missing,
+    // One of the fields wasn't a string
+    WrongType,
+};
+
+/// Pulls the given fields out of a JSON object in a single pass, without
+/// building anything for the rest of it. Every field is required and must be a
+/// string. Any other keys are checked and skipped, and parsing stops as soon
+/// as a limit is hit, so hostile bodies can't make it do much work.
+///
+/// The values are stored in `values`, in the same order as `fields`. They
+/// point into `body` unless they had to be unescaped, in which case they're
+/// allocated from `arena`. If a key appears more than once, the last one wins.
+Result<std::monostate, JsonError>
+extract_json_fields(std::string_view body, std::span<const JsonField> fields,
+                    std::span<std::string_view> values,
+                    std::pmr::memory_resource *arena);
\ No newline at end of file
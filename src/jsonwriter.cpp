@@ -0,0 +1,139 @@
+#include "jsonwriter.hpp"
+#include "util.hpp"
+
+#include <charconv>
+
+using std::string_view;
+
+void JsonWriter::separate() {
+    if(m_need_comma) {
+        m_out += ',';
+    }
+}
+
+JsonWriter &JsonWriter::begin_object() {
+    separate();
+    m_out += '{';
+    m_need_comma = false;
+    return *this;
+}
+
+JsonWriter &JsonWriter::end_object() {
+    m_out += '}';
+    m_need_comma = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::begin_array() {
+    separate();
+    m_out += '[';
+    m_need_comma = false;
+    return *this;
+}
+
+JsonWriter &JsonWriter::end_array() {
+    m_out += ']';
+    m_need_comma = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::key(string_view key) {
+    separate();
+    write_string(key);
+    m_out += ':';
+    m_need_comma = false;
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(string_view str) {
+    separate();
+    write_string(str);
+    m_need_comma = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(int64_t num) {
+    separate();
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), num);
+    m_out.append(buf, res.ptr);
+    m_need_comma = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(bool b) {
+    separate();
+    m_out += b ? "true" : "false";
+    m_need_comma = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::null() {
+    separate();
+    m_out += "null";
+    m_need_comma = true;
+    return *this;
+}
+
+void JsonWriter::write_string(string_view str) {
+    constexpr char HEX[] = "0123456789abcdef";
+
+    m_out.reserve(m_out.size() + str.size() + 2);
+    m_out += '"';
+    // characters that don't need escaping are copied over in runs
+    size_t run = 0;
+    size_t i = 0;
+    while(i < str.size()) {
+        unsigned char ch = str[i];
+        size_t len = 1;
+        if(ch >= 0x20 && ch != '"' && ch != '\\' && ch < 0x80) {
+            i++;
+            continue;
+        }
+        if(ch >= 0x80) {
+            len = utf8_sequence_length(str.substr(i));
+            if(len > 0) {
+                i += len;
+                continue;
+            }
+            len = 1;
+        }
+
+        m_out.append(str.data() + run, i - run);
+        switch(ch) {
+        case '"':
+            m_out += "\\\"";
+            break;
+        case '\\':
+            m_out += "\\\\";
+            break;
+        case '\b':
+            m_out += "\\b";
+            break;
+        case '\f':
+            m_out += "\\f";
+            break;
+        case '\n':
+            m_out += "\\n";
+            break;
+        case '\r':
+            m_out += "\\r";
+            break;
+        case '\t':
+            m_out += "\\t";
+            break;
+        default:
+            if(ch >= 0x80) {
+                m_out += "\\ufffd";
+            } else {
+                m_out += "\\u00";
+                m_out += HEX[ch >> 4];
+                m_out += HEX[ch & 0xf];
+            }
+        }
+        i += len;
+        run = i;
+    }
+    m_out.append(str.data() + run, str.size() - run);
+    m_out += '"';
+}
\ No newline at end of file
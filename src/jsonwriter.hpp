@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// Writes JSON straight into a string as it goes, without building a tree
+/// first. It keeps track of commas, but not of nesting, so it's up to the
+/// caller to close everything that it opens (and to only write keys inside of
+/// objects).
+///
+/// Strings are expected to be UTF-8. Invalid sequences are replaced with
+/// U+FFFD, so the output is always valid JSON.
+class JsonWriter {
+  private:
+    std::string &m_out;
+    // whether the next key or value needs a comma in front of it
+    bool m_need_comma{false};
+
+    void separate();
+    void write_string(std::string_view str);
+
+  public:
+    inline explicit JsonWriter(std::string &out) : m_out{out} {
+    }
+
+    JsonWriter &begin_object();
+    JsonWriter &end_object();
+    JsonWriter &begin_array();
+    JsonWriter &end_array();
+    JsonWriter &key(std::string_view key);
+
+    JsonWriter &value(std::string_view str);
+    inline JsonWriter &value(const char *str) {
+        return value(std::string_view(str));
+    }
+    JsonWriter &value(int64_t num);
+    JsonWriter &value(bool b);
+    JsonWriter &null();
+
+    /// Shorthand for key(key).value(val).
+    template <typename T>
+    inline JsonWriter &field(std::string_view key, const T &val) {
+        return this->key(key).value(val);
+    }
+};
\ No newline at end of file
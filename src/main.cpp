@@ -17,6 +17,7 @@
 #include <plog/Severity.h>
 #include <psa/crypto.h>
 
+#include <csignal>
 #include <memory>
 
 using std::ifstream, std::stringstream, std::string;
@@ -24,6 +25,16 @@ using std::ifstream, std::stringstream, std::string;
 #define REGISTER_HANDLER(Type, ...)                                            \
     server.register_handler(std::make_unique<Type>(__VA_ARGS__))
 
+// set while the server is running, so that it can be stopped by a signal
+static Server *running_server = nullptr;
+
+static void handle_signal(int) {
+    // all this does is set an atomic flag, which is safe to do in here
+    if(nullptr != running_server) {
+        running_server->stop();
+    }
+}
+
 int main(void) {
     if(PSA_SUCCESS != psa_crypto_init()) {
         PLOG_FATAL << "Failed to initialize PSA crypto.";
@@ -55,8 +66,15 @@ int main(void) {
     }
     const string &cert = cert_r.get_ok();
 
-    Database db(config.get_db_connection());
-    Server server(db, config.get_listen_urls(), key, cert);
+    Database db(config.get_db_connection(), config.get_db_tuning());
+    Server server(db, config.get_listen_urls(), key, cert,
+                  config.get_worker_threads(), config.get_event_loops(),
+                  config.get_session_refresh_seconds(),
+                  config.get_max_connections(),
+                  config.get_max_connections_per_ip(),
+                  config.get_access_log_filename(),
+                  config.get_access_log_format(),
+                  config.get_max_lost_visitors());
     REGISTER_HANDLER(LoginGetHandler);
     REGISTER_HANDLER(LoginPostHandler, server);
     REGISTER_HANDLER(LogoutHandler);
@@ -79,7 +97,14 @@ int main(void) {
     REGISTER_HANDLER(DirHandler, "/static/", "static");
     REGISTER_HANDLER(FileHandler, "/favicon.ico", "res/andromeda.ico");
 
+    // stopping properly (rather than just dying) lets the queued writes and
+    // the visitor count make it to the database
+    running_server = &server;
+    std::signal(SIGINT, handle_signal);
+    std::signal(SIGTERM, handle_signal);
     server.start();
+    running_server = nullptr;
+    PLOG_INFO << "stopping server";
 
     return 0;
 }
\ No newline at end of file
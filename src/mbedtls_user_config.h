@@ -0,0 +1,7 @@
+#pragma once
+
+// requests are handled on several threads, all of which use the PSA crypto API
+// (and the TLS layer on the event loop uses its RNG), so it has to be built
+// with locking enabled.
+#define MBEDTLS_THREADING_C
+#define MBEDTLS_THREADING_PTHREAD
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "util.hpp"
 
 #include <chrono>
+#include <string_view>
 
 using std::string, std::vector;
 
@@ -22,6 +23,7 @@ static void remove_less_than(int64_t val, vector<int64_t> &vals) {
 }
 
 void StringedRatelimit::perform_cleanup() {
+    std::lock_guard lock{m_mutex};
     int64_t cutoff = now<std::chrono::seconds>() - m_interval_seconds;
 
     for(auto it = m_attempts.begin(); it != m_attempts.end();) {
@@ -35,6 +37,7 @@ void StringedRatelimit::perform_cleanup() {
 }
 
 bool StringedRatelimit::attempt(const string &str) {
+    std::lock_guard lock{m_mutex};
     if(!m_attempts.contains(str)) {
         m_attempts[str] = vector<int64_t>{};
     }
@@ -50,4 +53,28 @@ bool StringedRatelimit::attempt(const string &str) {
         vec.push_back(current);
         return true;
     }
+}
+
+// ConnectionLimit
+
+size_t ConnectionLimit::AddrHash::operator()(const addr_t &addr) const {
+    return std::hash<std::string_view>{}(
+        std::string_view((const char *)addr.data(), addr.size()));
+}
+
+bool ConnectionLimit::acquire(const addr_t &addr) {
+    std::lock_guard lock{m_mutex};
+    m_total += 1;
+    size_t &count = m_per_addr[addr];
+    count += 1;
+    return m_total <= m_max_total && count <= m_max_per_addr;
+}
+
+void ConnectionLimit::release(const addr_t &addr) {
+    std::lock_guard lock{m_mutex};
+    m_total -= 1;
+    auto it = m_per_addr.find(addr);
+    if(it != m_per_addr.end() && --it->second == 0) {
+        m_per_addr.erase(it);
+    }
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -16,6 +18,7 @@ class ICleanup {
 class StringedRatelimit : public ICleanup {
   private:
     std::unordered_map<std::string, std::vector<int64_t>> m_attempts{};
+    std::mutex m_mutex{};
     size_t m_interval_size;
     int64_t m_interval_seconds;
 
@@ -31,4 +34,34 @@ class StringedRatelimit : public ICleanup {
         return std::max(m_interval_seconds / 10, (int64_t)10);
     }
     void perform_cleanup() override;
+};
+
+/// Keeps count of the open connections, both in total and per client address,
+/// so that admitting a new one doesn't mean walking all of the others.
+class ConnectionLimit {
+  public:
+    // an IPv4 address only takes up the first 4 bytes
+    using addr_t = std::array<uint8_t, 16>;
+
+  private:
+    struct AddrHash {
+        size_t operator()(const addr_t &addr) const;
+    };
+
+    std::unordered_map<addr_t, size_t, AddrHash> m_per_addr{};
+    std::mutex m_mutex{};
+    size_t m_total{0};
+    size_t m_max_total;
+    size_t m_max_per_addr;
+
+  public:
+    inline explicit ConnectionLimit(size_t max_total, size_t max_per_addr)
+        : m_max_total{max_total}, m_max_per_addr{max_per_addr} {
+    }
+
+    /// Counts a new connection from `addr`, and returns whether it fits
+    /// within the limits. It's counted either way, so every call must be
+    /// matched by a release() once the connection is closed.
+    bool acquire(const addr_t &addr);
+    void release(const addr_t &addr);
 };
\ No newline at end of file
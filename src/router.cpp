@@ -0,0 +1,126 @@
+#include "router.hpp"
+#include "handler.hpp"
+
+using std::string, std::string_view, std::optional;
+
+bool Router::insert(Table &table, string_view pattern, Target target) {
+    if(!pattern.ends_with('*') && !pattern.ends_with('#')) {
+        return table.exact.emplace(string(pattern), target).second;
+    }
+    bool crosses_slashes = pattern.back() == '#';
+    pattern.remove_suffix(1);
+
+    uint32_t node = 0;
+    for(char ch : pattern) {
+        uint32_t next = 0;
+        for(const auto &[child_ch, child] : table.prefixes[node].children) {
+            if(child_ch == ch) {
+                next = child;
+                break;
+            }
+        }
+
+        if(next == 0) {
+            next = table.prefixes.size();
+            table.prefixes.emplace_back();
+            table.prefixes[node].children.emplace_back(ch, next);
+        }
+        node = next;
+    }
+
+    auto &slot = crosses_slashes ? table.prefixes[node].rest
+                                 : table.prefixes[node].segment;
+    if(slot.has_value()) {
+        return false;
+    }
+    slot = target;
+    return true;
+}
+
+optional<RouteMatch> Router::find(const Table &table, string_view path) {
+    auto it = table.exact.find(path);
+    if(it != table.exact.end()) {
+        const Target &target = it->second;
+        return RouteMatch{target.handler, target.simple, target.needs_user,
+                          target.name, {}};
+    }
+
+    // a '*' only matches if the rest of the path has no slashes in it, i.e.
+    // if it starts after the last one
+    size_t last_slash = path.rfind('/');
+
+    // walk down as far as the path goes, remembering the deepest target that
+    // matches
+    const Target *best = nullptr;
+    size_t best_len = 0;
+    const TrieNode *node = &table.prefixes[0];
+    size_t i = 0;
+    while(true) {
+        if(node->segment.has_value() &&
+           (last_slash == string_view::npos || i > last_slash))
+        {
+            best = &*node->segment;
+            best_len = i;
+        } else if(node->rest.has_value()) {
+            best = &*node->rest;
+            best_len = i;
+        }
+        if(i == path.size()) {
+            break;
+        }
+
+        const TrieNode *next = nullptr;
+        for(const auto &[child_ch, child] : node->children) {
+            if(child_ch == path[i]) {
+                next = &table.prefixes[child];
+                break;
+            }
+        }
+        if(nullptr == next) {
+            break;
+        }
+        node = next;
+        i++;
+    }
+
+    if(nullptr == best) {
+        return {};
+    }
+    const Target &target = *best;
+    return RouteMatch{target.handler, target.simple, target.needs_user,
+                      target.name, path.substr(best_len)};
+}
+
+bool Router::add(const Route &route, BaseHandler *handler) {
+    const string &name = m_names.emplace_back(
+        (route.method.empty() ? "*" : route.method) + ' ' + route.pattern);
+    Target target{handler, dynamic_cast<SimpleHandler *>(handler),
+                  handler->needs_user(), name};
+
+    bool added{};
+    if(route.method.empty()) {
+        added = insert(m_any_method, route.pattern, target);
+    } else {
+        auto it = m_methods.find(route.method);
+        if(it == m_methods.end()) {
+            it = m_methods.emplace(route.method, Table{}).first;
+        }
+        added = insert(it->second, route.pattern, target);
+    }
+
+    if(!added) {
+        m_names.pop_back();
+    }
+    return added;
+}
+
+optional<RouteMatch> Router::find(string_view method, string_view path) const {
+    auto it = m_methods.find(method);
+    if(it != m_methods.end()) {
+        auto match = find(it->second, path);
+        if(match.has_value()) {
+            return match;
+        }
+    }
+    return find(m_any_method, path);
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class BaseHandler;
+class SimpleHandler;
+
+/// A single method + path combination that a handler answers to.
+struct Route {
+    // an empty method matches every method
+    std::string method;
+    // either an exact path, or a prefix followed by a single trailing wildcard
+    // that matches (and captures) the rest of the path. Like with mg_match,
+    // '*' stops at slashes and '#' doesn't.
+    std::string pattern;
+};
+
+struct RouteMatch {
+    BaseHandler *handler;
+    // set if the handler is a SimpleHandler, so that the server doesn't have
+    // to figure that out for every request
+    SimpleHandler *simple;
+    bool needs_user;
+    // the route as it was registered, e.g. "GET /api/short"
+    std::string_view name;
+    // whatever the trailing wildcard matched, if there was one
+    std::string_view param;
+};
+
+/// Maps requests to handlers. Everything is laid out when the routes are
+/// added, so a lookup is a hash of the path followed by (at most) a walk down
+/// a prefix trie, and never allocates.
+class Router {
+  private:
+    struct Target {
+        BaseHandler *handler;
+        SimpleHandler *simple;
+        bool needs_user;
+        std::string_view name;
+    };
+
+    struct StringHash {
+        using is_transparent = void;
+        inline size_t operator()(std::string_view str) const {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+
+    template <typename T>
+    using StringMap =
+        std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+    struct TrieNode {
+        std::vector<std::pair<char, uint32_t>> children{};
+        // the targets of the prefix followed by '*' and by '#'
+        std::optional<Target> segment{};
+        std::optional<Target> rest{};
+    };
+
+    // the routes of a single method (or of all of them)
+    struct Table {
+        StringMap<Target> exact{};
+        // node 0 is the root
+        std::vector<TrieNode> prefixes = std::vector<TrieNode>(1);
+    };
+
+    StringMap<Table> m_methods{};
+    Table m_any_method{};
+    // backing storage for the targets' names, which never moves
+    std::deque<std::string> m_names{};
+
+    static bool insert(Table &table, std::string_view pattern, Target target);
+    static std::optional<RouteMatch> find(const Table &table,
+                                          std::string_view path);
+
+  public:
+    /// Returns false if an identical route was already added, in which case
+    /// the earlier one is kept.
+    bool add(const Route &route, BaseHandler *handler);
+    /// Routes of the request's own method take precedence over the ones that
+    /// match every method, and exact paths take precedence over prefixes.
+    /// Between prefixes, the longest one wins, and '*' wins over '#'.
+    std::optional<RouteMatch> find(std::string_view method,
+                                   std::string_view path) const;
+};
\ No newline at end of file
@@ -8,9 +8,19 @@
 #include <plog/Log.h>
 #include <psa/crypto.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
-#include <limits>
+#include <cctype>
+#include <cstring>
+#include <exception>
 #include <string>
+#include <string_view>
 
 using std::string, std::vector, std::unique_ptr, std::shared_ptr, std::optional;
 
@@ -22,92 +32,283 @@ static string mg_addr_to_string(mg_addr addr) {
 
 // HttpMessage
 
-static string mg_str_to_string(mg_str str) {
-    return string(str.buf, str.len);
+optional<string> HttpMessage::resolve_username() const {
+    if(nullptr == m_auth) {
+        return {};
+    }
+
+    auto id = get_id_cookie();
+    if(!id.has_value()) {
+        return {};
+    }
+
+    auto token_r = Token::parse(*id);
+    if(token_r.is_err()) {
+        return {};
+    }
+
+    auto user_r = m_auth->get_user_of_token(token_r.get_ok());
+    if(user_r.is_err()) {
+        return {};
+    }
+    return user_r.get_ok();
+}
+
+static void rebase(mg_str &str, const char *old_base, char *new_base) {
+    if(nullptr != str.buf) {
+        str.buf = new_base + (str.buf - old_base);
+    }
+}
+
+unique_ptr<HttpMessage> HttpMessage::clone() const {
+    // every field of the parsed message points somewhere inside of `message`
+    // (mongoose relocates chunked bodies right after the headers), so copying
+    // that one region and shifting all of the pointers is enough
+    unique_ptr<HttpMessage> copy{new HttpMessage(nullptr, m_peer_addr)};
+    copy->m_auth = m_auth;
+    copy->m_username_resolved = m_username_resolved;
+    copy->m_username = m_username;
+    size_t len = m_msg->message.len;
+    char *new_base = (char *)copy->m_arena.allocate(len + 1, 1);
+    std::memcpy(new_base, m_msg->message.buf, len);
+    new_base[len] = '\0';
+
+    mg_http_message &msg = copy->m_owned_msg;
+    msg = *m_msg;
+    const char *old_base = m_msg->message.buf;
+    for(mg_str *str : {&msg.method, &msg.uri, &msg.query, &msg.proto,
+                       &msg.body, &msg.head, &msg.message})
+    {
+        rebase(*str, old_base, new_base);
+    }
+    copy->m_path_param = m_path_param;
+    rebase(copy->m_path_param, old_base, new_base);
+    for(mg_http_header &header : msg.headers) {
+        rebase(header.name, old_base, new_base);
+        rebase(header.value, old_base, new_base);
+    }
+
+    copy->m_msg = &msg;
+    return copy;
+}
+
+static std::string_view mg_str_to_view(mg_str str) {
+    return std::string_view(str.buf, str.len);
 }
 
-void HttpMessage::set_username(std::string username) {
-    m_username = username;
+std::string_view HttpMessage::get_uri() const {
+    return mg_str_to_view(m_msg->uri);
 }
 
-string HttpMessage::get_uri() const {
-    return mg_str_to_string(m_msg->uri);
+std::string_view HttpMessage::get_method() const {
+    return mg_str_to_view(m_msg->method);
 }
 
-string HttpMessage::get_method() const {
-    return mg_str_to_string(m_msg->method);
+std::string_view HttpMessage::get_path_param() const {
+    return mg_str_to_view(m_path_param);
 }
 
-string HttpMessage::get_body() const {
-    return get_body(std::numeric_limits<size_t>::max());
+std::string_view HttpMessage::get_body() const {
+    return mg_str_to_view(m_msg->body);
 }
 
-string HttpMessage::get_body(size_t limit) const {
-    return string(m_msg->body.buf, std::min(m_msg->body.len, limit));
+std::string_view HttpMessage::get_body(size_t limit) const {
+    return get_body().substr(0, limit);
 }
 
-optional<string> HttpMessage::get_id_cookie() const {
-    mg_str *cookie = mg_http_get_header(m_msg, "Cookie");
-    if(nullptr == cookie) {
+optional<std::string_view> HttpMessage::get_header(const char *name) const {
+    mg_str *header = mg_http_get_header(m_msg, name);
+    if(nullptr == header) {
         return {};
     }
-    mg_str id = mg_http_get_header_var(*cookie, mg_str_s("id"));
-    if(0 == id.len) {
-        return {};
-    } else {
-        return string(id.buf, id.len);
+    return mg_str_to_view(*header);
+}
+
+// splits `content` on `separator` and then on the first '=' of every part.
+// with `decode` set (form and query vars), values are percent-decoded (`form`
+// as in mg_url_decode), and the parts are read like mg_http_var does: keys
+// are matched regardless of case, and a part without '=' is a key with an
+// empty value. otherwise (cookies), leading spaces are skipped and parts
+// without '=' are ignored.
+void HttpMessage::Vars::parse(std::string_view content, char separator,
+                              bool decode, bool form) {
+    parsed = true;
+    ignore_case = decode;
+    // decoding never makes anything longer, so this is enough for all of the
+    // values together (plus the NUL that mg_url_decode insists on writing)
+    decoded.reserve(decode ? content.size() + 1 : 0);
+
+    while(!content.empty()) {
+        size_t end = content.find(separator);
+        std::string_view part = content.substr(0, end);
+        content.remove_prefix(end == content.npos ? content.size() : end + 1);
+
+        while(!decode && part.starts_with(' ')) {
+            part.remove_prefix(1);
+        }
+        size_t eq = part.find('=');
+        if(part.empty() || (!decode && eq == part.npos)) {
+            continue;
+        }
+
+        std::string_view key = part.substr(0, eq);
+        std::string_view value =
+            eq == part.npos ? std::string_view{} : part.substr(eq + 1);
+        bool plain = !decode || value.find_first_of(form ? "%+" : "%") ==
+                                    value.npos;
+        if(plain) {
+            entries.emplace_back(key, value);
+            continue;
+        }
+
+        size_t start = decoded.size();
+        decoded.resize(start + value.size() + 1);
+        int len = mg_url_decode(value.data(), value.size(),
+                                decoded.data() + start, value.size() + 1, form);
+        if(len < 0) {
+            decoded.resize(start);
+            entries.emplace_back(key, std::nullopt);
+        } else {
+            decoded.resize(start + len);
+            entries.emplace_back(key,
+                                 std::string_view(decoded.data() + start, len));
+        }
     }
 }
 
-mg_addr HttpMessage::get_peer_addr() const {
-    return m_peer_addr;
+static bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++) {
+        if(std::tolower((unsigned char)a[i]) !=
+           std::tolower((unsigned char)b[i]))
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
-const optional<string> &HttpMessage::get_username() const {
-    return m_username;
+// the first entry with the given key wins, like with mg_http_var
+optional<std::string_view> HttpMessage::Vars::find(std::string_view key) const {
+    for(const auto &[entry_key, value] : entries) {
+        if(ignore_case ? equals_ignoring_case(entry_key, key)
+                       : entry_key == key)
+        {
+            return value;
+        }
+    }
+    return {};
 }
 
-template <bool is_form>
-static optional<string> get_var_inner(mg_str content, const string &key) {
-    mg_str res = mg_http_var(content, mg_str_n(key.data(), key.size()));
-    if(nullptr == res.buf) {
-        return {};
+optional<std::string_view> HttpMessage::get_id_cookie() const {
+    if(!m_cookies.parsed) {
+        mg_str *cookie = mg_http_get_header(m_msg, "Cookie");
+        m_cookies.parse(nullptr == cookie ? std::string_view{}
+                                          : mg_str_to_view(*cookie),
+                        ';', false, false);
     }
 
-    string value(res.buf, res.len);
-    auto decode = percent_decode(value, is_form);
-    if(decode.is_err()) {
+    auto id = m_cookies.find("id");
+    if(!id.has_value() || id->empty()) {
         return {};
     }
-    return decode.get_ok();
+    return id;
 }
 
-optional<string> HttpMessage::get_form_var(const string &key) const {
-    return get_var_inner<true>(m_msg->body, key);
+mg_addr HttpMessage::get_peer_addr() const {
+    return m_peer_addr;
+}
+
+const optional<string> &HttpMessage::get_username() const {
+    if(!m_username_resolved) {
+        m_username = resolve_username();
+        m_username_resolved = true;
+    }
+    return m_username;
 }
 
-std::optional<std::string> HttpMessage::get_query_var(
-    const std::string &key) const {
-    return get_var_inner<false>(m_msg->query, key);
+optional<std::string_view> HttpMessage::get_form_var(
+    std::string_view key) const {
+    if(!m_form.parsed) {
+        m_form.parse(get_body(), '&', true, true);
+    }
+    return m_form.find(key);
+}
+
+optional<std::string_view> HttpMessage::get_query_var(
+    std::string_view key) const {
+    if(!m_query.parsed) {
+        m_query.parse(mg_str_to_view(m_msg->query), '&', true, false);
+    }
+    return m_query.find(key);
 }
 
 // Server
 
 Server::Server(Database &db, const vector<string> &listen_urls,
-               const string &key, const string &cert)
-    : m_db{db}, m_auth{Auth::with_db(db)},
-      m_listen_urls{listen_urls}, m_key{key}, m_cert{cert} {
-    PLOG_INFO << "initializing server";
+               const string &key, const string &cert, size_t worker_threads,
+               size_t event_loops, int64_t session_refresh_seconds,
+               size_t max_connections, size_t max_connections_per_ip,
+               const string &access_log_filename,
+               AccessLogFormat access_log_format, int64_t max_lost_visitors)
+    : m_db{db}, m_async_db{db},
+      m_auth{Auth::with_db(db, m_async_db, session_refresh_seconds)},
+      m_conn_limit{max_connections, max_connections_per_ip},
+      m_listen_urls{listen_urls},
+      m_tls{std::make_shared<TlsContext>(db, key, cert)},
+      m_visitors{std::make_shared<VisitorCounter>(db, m_async_db,
+                                                  max_lost_visitors)},
+      m_access_log{access_log_filename, access_log_format},
+      m_pool{worker_threads} {
+#ifndef SO_REUSEPORT
+    if(event_loops > 1) {
+        PLOG_WARNING << "SO_REUSEPORT is not supported on this platform; "
+                        "running a single event loop";
+        event_loops = 1;
+    }
+#endif
+    PLOG_INFO << "initializing server with " << event_loops
+              << " event loops and " << m_pool.size() << " worker threads";
 
     mg_log_set(MG_LL_NONE);
 
-    mg_mgr_init(&m_manager);
+    for(size_t i = 0; i < event_loops; i++) {
+        auto loop = std::make_unique<EventLoop>();
+        mg_mgr_init(&loop->manager);
+        loop->manager.userdata = loop.get();
+        loop->manager.tls_ctx = m_tls.get();
+        if(!mg_wakeup_init(&loop->manager)) {
+            PLOG_FATAL << "could not initialize the event loop wakeup pipe";
+            exit(1);
+        }
+        m_loops.push_back(std::move(loop));
+    }
 
     register_cleanup(std::make_shared<SessionTokenCleanup>(m_db));
+    register_cleanup(m_auth.get_session_cache());
+    register_cleanup(m_tls);
+    register_cleanup(m_visitors);
 }
 
 Server::~Server() {
-    mg_mgr_free(&m_manager);
+    stop();
+    for(auto &loop : m_loops) {
+        if(loop->thread.joinable()) {
+            loop->thread.join();
+        }
+    }
+
+    // the workers and the database thread may still want to wake up the event
+    // loops, so they have to be gone before those are freed. the workers go
+    // first, since they queue up writes.
+    m_pool.shutdown();
+    m_async_db.shutdown();
+    m_visitors->flush();
+    for(auto &loop : m_loops) {
+        mg_mgr_free(&loop->manager);
+    }
     PLOG_INFO << "server destroyed";
 }
 
@@ -116,17 +317,115 @@ static void cleanup_callback(void *ptr) {
     cleanup->perform_cleanup();
 }
 
+#ifdef SO_REUSEPORT
+static int open_reuseport_listener(mg_addr addr) {
+    sockaddr_storage storage{};
+    socklen_t len{};
+    if(addr.is_ip6) {
+        sockaddr_in6 *sin6 = (sockaddr_in6 *)&storage;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = addr.port;
+        sin6->sin6_scope_id = addr.scope_id;
+        std::memcpy(&sin6->sin6_addr, addr.ip, sizeof(sin6->sin6_addr));
+        len = sizeof(*sin6);
+    } else {
+        sockaddr_in *sin = (sockaddr_in *)&storage;
+        sin->sin_family = AF_INET;
+        sin->sin_port = addr.port;
+        std::memcpy(&sin->sin_addr, addr.ip, sizeof(sin->sin_addr));
+        len = sizeof(*sin);
+    }
+
+    int fd = socket(storage.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if(fd < 0) {
+        return -1;
+    }
+
+    int on = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+       setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+       bind(fd, (sockaddr *)&storage, len) != 0 || listen(fd, SOMAXCONN) != 0 ||
+       fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+mg_connection *Server::open_listener(EventLoop &loop, const string &url) {
+    if(m_loops.size() == 1) {
+        return mg_http_listen(&loop.manager, url.c_str(),
+                              Server::event_listener_glue, this);
+    }
+
+#ifdef SO_REUSEPORT
+    // every loop gets its own listener on the same address, and the kernel
+    // spreads the incoming connections between them. mongoose can't set
+    // SO_REUSEPORT before binding, so it's made to listen on an ephemeral port
+    // and then its socket is swapped for ours. this keeps the HTTP protocol
+    // handler and the TLS flag that it attaches to the listener.
+    mg_addr addr{};
+    if(!mg_aton(mg_url_host(url.c_str()), &addr)) {
+        return nullptr;
+    }
+    addr.port = mg_htons(mg_url_port(url.c_str()));
+
+    int fd = open_reuseport_listener(addr);
+    if(fd < 0) {
+        return nullptr;
+    }
+
+    string placeholder = string(mg_url_is_ssl(url.c_str()) ? "https" : "http") +
+                         (addr.is_ip6 ? "://[::1]:0" : "://127.0.0.1:0");
+    mg_connection *conn = mg_http_listen(&loop.manager, placeholder.c_str(),
+                                         Server::event_listener_glue, this);
+    if(conn == nullptr) {
+        close(fd);
+        return nullptr;
+    }
+    // closing the placeholder also drops it from mongoose's epoll set (if it
+    // uses one), so the new socket has to be registered in its place
+    close((int)(size_t)conn->fd);
+    conn->fd = (void *)(size_t)fd;
+    conn->loc = addr;
+    MG_EPOLL_ADD(conn);
+    return conn;
+#else
+    return nullptr;
+#endif
+}
+
+void Server::run_loop(EventLoop &loop) {
+    while(!m_stopping) {
+        mg_mgr_poll(&loop.manager, 1000);
+    }
+}
+
 void Server::start() {
     PLOG_INFO << "starting server.";
 
     int urls_left = m_listen_urls.size();
     for(const auto &url : m_listen_urls) {
+        vector<mg_connection *> listeners{};
+        for(auto &loop : m_loops) {
+            mg_connection *conn = open_listener(*loop, url);
+            if(conn == nullptr) {
+                break;
+            }
+            listeners.push_back(conn);
+        }
 
-        auto ret = mg_http_listen(&m_manager, url.c_str(),
-                                  Server::event_listener_glue, this);
-        if(ret != nullptr) {
+        if(listeners.size() == m_loops.size()) {
             PLOG_INFO << "listening on " << url;
         } else {
+            // the loops that did get a listener would be the only ones to take
+            // connections on this url, so it's given up on entirely. the
+            // listeners are closed on the loops' first poll.
+            for(mg_connection *conn : listeners) {
+                conn->is_closing = 1;
+            }
             PLOG_ERROR << "could not listen on " << url;
             urls_left -= 1;
         }
@@ -136,15 +435,25 @@ void Server::start() {
         exit(1);
     }
 
+    // the cleanups are shared between the loops (and the workers), so only
+    // the first loop runs them
+    EventLoop &main_loop = *m_loops[0];
     for(const auto &cleanup : m_cleanups) {
-        mg_timer_add(&m_manager, cleanup->get_cleanup_interval_seconds() * 1000,
+        mg_timer_add(&main_loop.manager,
+                     cleanup->get_cleanup_interval_seconds() * 1000,
                      MG_TIMER_REPEAT | MG_TIMER_RUN_NOW, cleanup_callback,
                      cleanup.get());
     }
 
-    while(true) {
-        mg_mgr_poll(&m_manager, 1000);
+    for(size_t i = 1; i < m_loops.size(); i++) {
+        EventLoop &loop = *m_loops[i];
+        loop.thread = std::thread([this, &loop] { run_loop(loop); });
     }
+    run_loop(main_loop);
+}
+
+void Server::stop() {
+    m_stopping = true;
 }
 
 void Server::event_listener_glue(mg_connection *conn, int event, void *data) {
@@ -152,74 +461,57 @@ void Server::event_listener_glue(mg_connection *conn, int event, void *data) {
     server->event_listener(conn, event, data);
 }
 
-// reads the status code of the message that's about to be sent.
-// this is a *little* cursed but unfortunately mongoose doesn't provide an API
-// for this, and i can't pass it myself because i also need to get the status
-// code of e.g. served directories
-static int read_status_code(mg_connection *conn) {
-    constexpr size_t MAX = std::numeric_limits<size_t>::max();
-    size_t first_space{MAX}, second_space{MAX};
-    for(size_t i{0}; i < conn->send.len; i++) {
-        if(conn->send.buf[i] != ' ')
-            continue;
-        if(first_space == MAX) {
-            first_space = i;
-        } else {
-            second_space = i;
-            break;
-        }
-    }
-    if(first_space == MAX || second_space == MAX) {
-        return -1;
+// IPv4 addresses only fill the first 4 bytes of mg_addr::ip, so they're keyed
+// as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d) to keep them apart from
+// IPv6 addresses that happen to start with the same bytes
+static ConnectionLimit::addr_t addr_key(const mg_addr &addr) {
+    ConnectionLimit::addr_t key{};
+    if(addr.is_ip6) {
+        std::copy(std::begin(addr.ip), std::end(addr.ip), key.begin());
+    } else {
+        key[10] = 0xff;
+        key[11] = 0xff;
+        std::copy(addr.ip, addr.ip + 4, key.begin() + 12);
     }
-
-    string substr((const char *)&conn->send.buf[first_space + 1],
-                  second_space - first_space - 1);
-    return std::stoi(substr);
+    return key;
 }
 
-static int numconns(mg_mgr *mgr) {
-    int n = 0;
-    for(mg_connection *t = mgr->conns; t != NULL; t = t->next)
-        n++;
-    return n;
+void Server::log_request(const HttpMessage &msg, const RequestContext &ctx) {
+    using std::chrono::steady_clock, std::chrono::microseconds;
+
+    AccessLog::Record record{};
+    record.timestamp = now<std::chrono::milliseconds>();
+    record.latency_micros = std::chrono::duration_cast<microseconds>(
+                                steady_clock::now() - ctx.started)
+                                .count();
+    record.peer = msg.get_peer_addr();
+    record.status_code = ctx.status_code;
+    record.response_size = (uint32_t)ctx.response_size;
+    record.set_method(msg.get_method());
+    record.set_route(ctx.handler);
+    record.set_uri(msg.get_uri());
+    if(!ctx.confidential) {
+        record.set_body(msg.get_body());
+    }
+    m_access_log.push(record);
 }
 
 void Server::event_listener(mg_connection *conn, int event, void *data) {
     if(event == MG_EV_HTTP_MSG) {
         HttpMessage msg((mg_http_message *)data, conn->rem);
-        auto id = msg.get_id_cookie();
-        do {
-            if(!id.has_value())
-                break;
-
-            auto token_r = Token::parse(*id);
-            if(token_r.is_err())
-                break;
-
-            auto user_r = m_auth.get_user_of_token(token_r.get_ok());
-            if(user_r.is_err())
-                break;
-
-            msg.set_username(user_r.get_ok());
-        } while(false);
-        bool confidential{false};
-        handle_http(conn, msg, confidential);
-
-        int status_code = read_status_code(conn);
-        string body{};
-        if(!confidential) {
-            body = msg.get_body(40);
-            std::replace(body.begin(), body.end(), '\n', ' ');
+        RequestContext ctx{.started = std::chrono::steady_clock::now()};
+        if(handle_http(conn, msg, ctx)) {
+            log_request(msg, ctx);
         }
-
-        // clang-format off
-        PLOG_INFO << mg_addr_to_string(msg.get_peer_addr()) << " "
-                  << msg.get_method() << " "
-                  << status_code << " "
-                  << msg.get_uri() << " "
-                  << body;
-        // clang-format on
+    } else if(event == MG_EV_WAKEUP) {
+        finish_deferred(conn);
+    } else if(event == MG_EV_CLOSE) {
+        if(conn->is_accepted) {
+            m_conn_limit.release(addr_key(conn->rem));
+        }
+        EventLoop &loop = *(EventLoop *)conn->mgr->userdata;
+        std::lock_guard lock{loop.deferred_mutex};
+        loop.deferred.erase(conn->id);
     } else if(event == MG_EV_READ) {
         if(conn->recv.len > 2048) {
             PLOG_WARNING << "message too large; dropping "
@@ -227,33 +519,110 @@ void Server::event_listener(mg_connection *conn, int event, void *data) {
             conn->is_closing = 1;
         }
     } else if(event == MG_EV_ACCEPT) {
-        if(numconns(conn->mgr) > 50) {
+        if(!m_conn_limit.acquire(addr_key(conn->rem))) {
             PLOG_WARNING << "too many connections; dropping "
                          << mg_addr_to_string(conn->rem);
+            // no point in starting a handshake that's never going to be used
             conn->is_closing = 1;
+            return;
         }
 
+        // everything is already in the shared TLS context
         mg_tls_opts opts{};
-        opts.key = mg_str_n(m_key.c_str(), m_key.size());
-        opts.cert = mg_str_n(m_cert.c_str(), m_cert.size());
         mg_tls_init(conn, &opts);
     }
 }
 
-void Server::handle_http(mg_connection *conn, const HttpMessage &msg,
-                         bool &confidential) {
-    for(auto &handler : m_handlers) {
-        if(handler->matches(msg)) {
-            handler->handle(conn, *this, msg, confidential);
+/// Returns false if the response is going to be sent later on, once a worker
+/// thread is done with it.
+bool Server::handle_http(mg_connection *conn, HttpMessage &msg,
+                         RequestContext &ctx) {
+    auto route = m_router.find(msg.get_method(), msg.get_uri());
+    if(!route.has_value()) {
+        std::string_view headers[] = {
+            content_type_header(ContentType::TextPlain)};
+        std::string_view body[] = {"not found"};
+        ctx.status_code = 404;
+        ctx.response_size = write_response(conn, 404, headers, body);
+        return true;
+    }
+    ctx.handler = route->name;
+    msg.m_path_param = mg_str_n(route->param.data(), route->param.size());
+    if(route->needs_user) {
+        msg.m_auth = &m_auth;
+    }
+
+    // simple handlers may block (on the database, on template rendering, on
+    // password hashing...) so they don't get to run on the event loop
+    if(nullptr != route->simple) {
+        defer(conn, *route->simple, msg, ctx);
+        return false;
+    }
+    route->handler->handle(conn, *this, msg, ctx);
+    return true;
+}
+
+void Server::defer(mg_connection *conn, SimpleHandler &handler,
+                   const HttpMessage &msg, const RequestContext &ctx) {
+    EventLoop &loop = *(EventLoop *)conn->mgr->userdata;
+    auto deferred = std::make_shared<Deferred>(msg.clone());
+    deferred->ctx = ctx;
+    {
+        std::lock_guard lock{loop.deferred_mutex};
+        loop.deferred[conn->id] = deferred;
+    }
+
+    // mongoose won't parse the next pipelined request on this connection
+    // until the response is sent, so there's at most one of these per
+    // connection
+    m_pool.submit([this, &handler, &loop, deferred, id = conn->id] {
+        // the handler may call this from another thread, after it's returned
+        Responder done = [&loop, deferred, id](HttpResponse response) {
+            std::lock_guard lock{loop.deferred_mutex};
+            if(deferred->done) {
+                return;
+            }
+            deferred->response = std::move(response);
+            deferred->done = true;
+            auto it = loop.deferred.find(id);
+            if(it != loop.deferred.end() && it->second == deferred) {
+                mg_wakeup(&loop.manager, id, "", 0);
+            }
+        };
+
+        try {
+            handler.respond_async(*this, *deferred->msg, deferred->ctx, done);
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "exception while handling request: " << e.what();
+            done(HttpResponse{.status_code = 500});
+        }
+    });
+}
+
+void Server::finish_deferred(mg_connection *conn) {
+    EventLoop &loop = *(EventLoop *)conn->mgr->userdata;
+    shared_ptr<Deferred> deferred{};
+    {
+        std::lock_guard lock{loop.deferred_mutex};
+        auto it = loop.deferred.find(conn->id);
+        if(it == loop.deferred.end() || !it->second->done) {
             return;
         }
+        deferred = std::move(it->second);
+        loop.deferred.erase(it);
     }
 
-    mg_http_reply(conn, 404, "Content-Type: text/plain;\r\n", "%s",
-                  "not found");
+    deferred->response.send(conn, deferred->ctx);
+    log_request(*deferred->msg, deferred->ctx);
 }
 
 void Server::register_handler(unique_ptr<BaseHandler> handler) {
+    for(const Route &route : handler->routes()) {
+        if(!m_router.add(route, handler.get())) {
+            PLOG_WARNING << "route " << route.method << " " << route.pattern
+                         << " is already taken; ignoring it";
+        }
+    }
     m_handlers.push_back(std::move(handler));
 }
 
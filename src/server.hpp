@@ -1,68 +1,185 @@
 #pragma once
 
+#include "accesslog.hpp"
+#include "asyncdb.hpp"
 #include "auth.hpp"
 #include "db.hpp"
+#include "handler.hpp"
 #include "ratelimit.hpp"
+#include "router.hpp"
+#include "threadpool.hpp"
+#include "tls.hpp"
+#include "visitors.hpp"
 
 #include <mongoose/mongoose.h>
 
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+/// A view of a request that's currently being handled. Everything returned by
+/// the getters points into the connection's receive buffer (or into a copy of
+/// it), so it's only valid for as long as the message itself.
 class HttpMessage {
   private:
+    // a urlencoded string (or the cookie header) that was split up into its
+    // key-value pairs. keys are kept as they are, values are decoded (where
+    // applicable), and the ones that failed to decode are empty.
+    struct Vars {
+        bool parsed{false};
+        bool ignore_case{false};
+        std::pmr::vector<
+            std::pair<std::string_view, std::optional<std::string_view>>>
+            entries;
+        // backing storage for the values that actually needed decoding.
+        // reserved up front so that it never reallocates from under the views.
+        std::pmr::string decoded;
+
+        inline explicit Vars(std::pmr::memory_resource *arena)
+            : entries{arena}, decoded{arena} {
+        }
+
+        void parse(std::string_view content, char separator, bool decode,
+                   bool form);
+        std::optional<std::string_view> find(std::string_view key) const;
+    };
+
+    // enough for a copy of the largest request we accept, plus its variables
+    static constexpr size_t ARENA_SIZE = 4096;
+
+    // everything that's allocated on behalf of the request comes from here,
+    // and is all freed at once along with the message. unless the request is
+    // unusually large, that never touches the heap.
+    std::array<std::byte, ARENA_SIZE> m_arena_buffer;
+    mutable std::pmr::monotonic_buffer_resource m_arena{m_arena_buffer.data(),
+                                                        m_arena_buffer.size()};
+
     mg_http_message *m_msg;
     mg_addr m_peer_addr;
-    std::optional<std::string> m_username{};
+    // the username is looked up on first use, and only if the handler said
+    // it needs one (m_auth is null otherwise)
+    Auth *m_auth{nullptr};
+    mutable bool m_username_resolved{false};
+    mutable std::optional<std::string> m_username{};
+    // whatever the trailing wildcard of the matched route captured
+    mg_str m_path_param{};
+    // parsed on first use
+    mutable Vars m_query{&m_arena};
+    mutable Vars m_form{&m_arena};
+    mutable Vars m_cookies{&m_arena};
+    // only used by copies, which must outlive the connection's receive buffer.
+    // the message itself is copied into the arena.
+    mg_http_message m_owned_msg{};
 
     HttpMessage() = delete;
+    HttpMessage(const HttpMessage &) = delete;
+    HttpMessage(HttpMessage &&) = delete;
     inline HttpMessage(mg_http_message *msg, mg_addr peer_addr)
         : m_msg{msg}, m_peer_addr{peer_addr} {};
-    void set_username(std::string username);
+    std::optional<std::string> resolve_username() const;
+    std::unique_ptr<HttpMessage> clone() const;
 
     friend class Server;
     friend class DirHandler;
     friend class FileHandler;
 
   public:
-    std::string get_uri() const;
-    std::string get_method() const;
-    std::string get_body() const;
-    std::string get_body(size_t limit) const;
-    std::optional<std::string> get_id_cookie() const;
+    std::string_view get_uri() const;
+    std::string_view get_method() const;
+    std::string_view get_path_param() const;
+    std::string_view get_body() const;
+    std::string_view get_body(size_t limit) const;
+    std::optional<std::string_view> get_header(const char *name) const;
+    std::optional<std::string_view> get_id_cookie() const;
     mg_addr get_peer_addr() const;
     const std::optional<std::string> &get_username() const;
-    std::optional<std::string> get_form_var(const std::string &key) const;
-    std::optional<std::string> get_query_var(const std::string &key) const;
+    std::optional<std::string_view> get_form_var(std::string_view key) const;
+    std::optional<std::string_view> get_query_var(std::string_view key) const;
+    /// Scratch memory for the handler, which lasts as long as the request.
+    inline std::pmr::memory_resource *get_arena() const {
+        return &m_arena;
+    }
 };
 class Server {
   private:
+    // a request that was handed to the worker pool, waiting for its response
+    struct Deferred {
+        std::unique_ptr<HttpMessage> msg;
+        HttpResponse response{};
+        RequestContext ctx{};
+        bool done{false};
+    };
+
+    // everything that belongs to a single event loop thread. the database,
+    // the handlers and the cleanups (rate limits and such) are shared between
+    // all of the loops, while connections and their bookkeeping are not.
+    struct EventLoop {
+        mg_mgr manager{};
+        std::thread thread{};
+        // keyed by connection id. entries are removed when the response is
+        // sent or when the connection closes, whichever happens first.
+        std::unordered_map<unsigned long, std::shared_ptr<Deferred>> deferred{};
+        std::mutex deferred_mutex{};
+    };
+
     Database &m_db;
+    AsyncDatabase m_async_db;
     Auth m_auth;
-    mg_mgr m_manager;
+    std::vector<std::unique_ptr<EventLoop>> m_loops{};
+    // shared by all of the loops, since they all accept on the same ports
+    ConnectionLimit m_conn_limit;
+    std::atomic<bool> m_stopping{false};
     std::vector<std::string> m_listen_urls;
     std::vector<std::unique_ptr<class BaseHandler>> m_handlers{};
+    Router m_router{};
     std::vector<std::shared_ptr<ICleanup>> m_cleanups{};
-    std::string m_key;
-    std::string m_cert;
+    std::shared_ptr<TlsContext> m_tls;
+    std::shared_ptr<VisitorCounter> m_visitors;
+    AccessLog m_access_log;
+    // declared last so that the workers are stopped before anything they use
+    // is destroyed
+    ThreadPool m_pool;
 
     static void event_listener_glue(mg_connection *conn, int event, void *data);
     void event_listener(mg_connection *conn, int event, void *data);
-    void handle_http(mg_connection *conn, const HttpMessage &msg,
-                     bool &confidential);
+    bool handle_http(mg_connection *conn, HttpMessage &msg,
+                     RequestContext &ctx);
+    void defer(mg_connection *conn, SimpleHandler &handler,
+               const HttpMessage &msg, const RequestContext &ctx);
+    void finish_deferred(mg_connection *conn);
+    /// Returns the listener, or nullptr if it couldn't be opened.
+    mg_connection *open_listener(EventLoop &loop, const std::string &url);
+    void run_loop(EventLoop &loop);
+    void log_request(const HttpMessage &msg, const RequestContext &ctx);
 
   public:
     Server() = delete;
     Server(const Server &) = delete;
     Server(Server &&) = delete;
     Server(Database &db, const std::vector<std::string> &listen_urls,
-           const std::string &key, const std::string &cert);
+           const std::string &key, const std::string &cert,
+           size_t worker_threads, size_t event_loops,
+           int64_t session_refresh_seconds, size_t max_connections,
+           size_t max_connections_per_ip,
+           const std::string &access_log_filename,
+           AccessLogFormat access_log_format, int64_t max_lost_visitors);
 
     ~Server();
 
+    /// Runs the event loops. The first one runs on the calling thread, so this
+    /// only returns once stop() is called.
     void start();
+    void stop();
     void register_handler(std::unique_ptr<BaseHandler> handler);
     void register_cleanup(std::shared_ptr<ICleanup> cleanup);
 
@@ -72,10 +189,16 @@ class Server {
     inline const Database &get_db() const {
         return m_db;
     }
+    inline AsyncDatabase &get_async_db() {
+        return m_async_db;
+    }
     inline Auth &get_auth() {
         return m_auth;
     }
     inline const Auth &get_auth() const {
         return m_auth;
     }
+    inline VisitorCounter &get_visitors() {
+        return *m_visitors;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "threadpool.hpp"
+
+#include <plog/Log.h>
+
+#include <exception>
+
+using std::function, std::mutex, std::unique_lock, std::lock_guard;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    for(size_t i = 0; i < num_threads; i++) {
+        m_threads.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+void ThreadPool::worker_loop() {
+    while(true) {
+        function<void()> job{};
+        {
+            unique_lock lock{m_mutex};
+            m_cv.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if(m_jobs.empty()) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        try {
+            job();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "uncaught exception in worker thread: " << e.what();
+        }
+    }
+}
+
+void ThreadPool::submit(function<void()> job) {
+    {
+        lock_guard lock{m_mutex};
+        if(m_stopping) {
+            return;
+        }
+        m_jobs.push_back(std::move(job));
+    }
+    m_cv.notify_one();
+}
+
+void ThreadPool::shutdown() {
+    {
+        lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+
+    for(auto &thread : m_threads) {
+        if(thread.joinable()) {
+            thread.join();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+  private:
+    std::vector<std::thread> m_threads{};
+    std::deque<std::function<void()>> m_jobs{};
+    std::mutex m_mutex{};
+    std::condition_variable m_cv{};
+    bool m_stopping{false};
+
+    void worker_loop();
+
+  public:
+    ThreadPool() = delete;
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool(ThreadPool &&) = delete;
+    explicit ThreadPool(size_t num_threads);
+    ~ThreadPool();
+
+    /// Queues a job to be run on one of the worker threads.
+    void submit(std::function<void()> job);
+    /// Finishes the queued jobs and joins all of the worker threads.
+    /// Jobs submitted afterwards are dropped.
+    void shutdown();
+
+    inline size_t size() const {
+        return m_threads.size();
+    }
+};
\ No newline at end of file
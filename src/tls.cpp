@@ -0,0 +1,308 @@
+#include "tls.hpp"
+#include "util.hpp"
+
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/threading.h>
+#include <mongoose/mongoose.h>
+#include <plog/Log.h>
+
+#include <chrono>
+#include <cstdlib>
+
+using std::string, std::chrono::seconds;
+
+static int rng(void *, unsigned char *buf, size_t len) {
+    mg_random(buf, len);
+    return 0;
+}
+
+// TlsContext
+
+// tickets (and cached sessions) are good for a day. the ticket key is
+// replaced twice as often, and the previous one is still accepted, so a
+// ticket is always readable for at least half of its lifetime.
+constexpr uint32_t TICKET_LIFETIME_SECONDS = 60 * 60 * 24;
+constexpr int64_t TICKET_ROTATION_SECONDS = TICKET_LIFETIME_SECONDS / 2;
+// how often the key's age is checked. the key's age carries over restarts, so
+// this is what keeps it from outliving TICKET_ROTATION_SECONDS by much.
+constexpr int64_t TICKET_CHECK_SECONDS = 60 * 60;
+constexpr int SESSION_CACHE_SIZE = 1000;
+
+// the ticket keys live next to Auth's HMAC keys (ids 0 and 1)
+constexpr int TICKET_KEY_ID = 2;
+constexpr int PREVIOUS_TICKET_KEY_ID = 3;
+
+// a stored key holds the ticket key name in its first bytes and the AES-256
+// key in its second half
+constexpr size_t TICKET_NAME_OFFSET = 0;
+constexpr size_t TICKET_NAME_LENGTH = 4;
+constexpr size_t TICKET_KEY_OFFSET = MAC_KEY_LENGTH / 2;
+constexpr size_t TICKET_KEY_LENGTH = 32;
+static_assert(TICKET_KEY_OFFSET + TICKET_KEY_LENGTH <= MAC_KEY_LENGTH);
+
+[[noreturn]] static void fatal(const string &message, int error) {
+    char buf[128]{};
+    mbedtls_strerror(error, buf, sizeof(buf));
+    PLOG_FATAL << message << ": " << buf;
+    exit(1);
+}
+
+TlsContext::TlsContext(const Database &db, const string &key,
+                       const string &cert)
+    : m_db{db} {
+    mbedtls_x509_crt_init(&m_cert);
+    mbedtls_pk_init(&m_key);
+    mbedtls_ssl_config_init(&m_conf);
+    mbedtls_ssl_cache_init(&m_session_cache);
+
+    int ret{};
+    // the PEM parsers want the terminating NUL to be part of the input
+    ret = mbedtls_x509_crt_parse(&m_cert, (const unsigned char *)cert.c_str(),
+                                 cert.size() + 1);
+    if(0 != ret) {
+        fatal("could not parse the TLS certificate", ret);
+    }
+    ret = mbedtls_pk_parse_key(&m_key, (const unsigned char *)key.c_str(),
+                               key.size() + 1, nullptr, 0, rng, nullptr);
+    if(0 != ret) {
+        fatal("could not parse the TLS key", ret);
+    }
+
+    ret = mbedtls_ssl_config_defaults(&m_conf, MBEDTLS_SSL_IS_SERVER,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if(0 != ret) {
+        fatal("could not set up the TLS config", ret);
+    }
+    mbedtls_ssl_conf_rng(&m_conf, rng, nullptr);
+    mbedtls_ssl_conf_authmode(&m_conf, MBEDTLS_SSL_VERIFY_NONE);
+    ret = mbedtls_ssl_conf_own_cert(&m_conf, &m_cert, &m_key);
+    if(0 != ret) {
+        fatal("could not set the TLS certificate", ret);
+    }
+
+    mbedtls_ssl_cache_set_max_entries(&m_session_cache, SESSION_CACHE_SIZE);
+    mbedtls_ssl_cache_set_timeout(&m_session_cache, TICKET_LIFETIME_SECONDS);
+    mbedtls_ssl_conf_session_cache(&m_conf, &m_session_cache,
+                                   mbedtls_ssl_cache_get,
+                                   mbedtls_ssl_cache_set);
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_ticket_init(&m_tickets);
+    ret = mbedtls_ssl_ticket_setup(&m_tickets, rng, nullptr,
+                                   MBEDTLS_CIPHER_AES_256_GCM,
+                                   TICKET_LIFETIME_SECONDS);
+    if(0 != ret) {
+        fatal("could not set up TLS session tickets", ret);
+    }
+
+    // the previous key goes in first, so that the current one ends up active
+    auto previous_r = m_db.get_sha256_hmac_key(PREVIOUS_TICKET_KEY_ID);
+    if(previous_r.is_ok()) {
+        use_ticket_key(previous_r.get_ok());
+    }
+    auto current_r = m_db.get_sha256_hmac_key(TICKET_KEY_ID);
+    auto rotated_r = m_db.get_key_rotation_time(TICKET_KEY_ID);
+    if(current_r.is_ok()) {
+        use_ticket_key(current_r.get_ok());
+    }
+    // a key of unknown age is treated as a stale one
+    if(current_r.is_ok() && rotated_r.is_ok() &&
+       now<seconds>() - rotated_r.get_ok() < TICKET_ROTATION_SECONDS)
+    {
+        m_last_rotation = rotated_r.get_ok();
+    } else {
+        rotate_ticket_key();
+    }
+
+    mbedtls_ssl_conf_session_tickets_cb(&m_conf, mbedtls_ssl_ticket_write,
+                                        mbedtls_ssl_ticket_parse, &m_tickets);
+#endif
+}
+
+TlsContext::~TlsContext() {
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_ticket_free(&m_tickets);
+#endif
+    mbedtls_ssl_cache_free(&m_session_cache);
+    mbedtls_ssl_config_free(&m_conf);
+    mbedtls_pk_free(&m_key);
+    mbedtls_x509_crt_free(&m_cert);
+}
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+void TlsContext::use_ticket_key(const mac_key_t &key) {
+    // mbedtls_ssl_ticket_rotate doesn't take the ticket context's lock, and
+    // the other event loops may be in the middle of a handshake
+#ifdef MBEDTLS_THREADING_C
+    mbedtls_mutex_lock(&m_tickets.MBEDTLS_PRIVATE(mutex));
+#endif
+    int ret = mbedtls_ssl_ticket_rotate(
+        &m_tickets, key.data() + TICKET_NAME_OFFSET, TICKET_NAME_LENGTH,
+        key.data() + TICKET_KEY_OFFSET, TICKET_KEY_LENGTH,
+        TICKET_LIFETIME_SECONDS);
+#ifdef MBEDTLS_THREADING_C
+    mbedtls_mutex_unlock(&m_tickets.MBEDTLS_PRIVATE(mutex));
+#endif
+    if(0 != ret) {
+        fatal("could not set the TLS ticket key", ret);
+    }
+}
+
+void TlsContext::rotate_ticket_key() {
+    mac_key_t key{};
+    mg_random(key.data(), key.size());
+
+    int64_t rotated = now<seconds>();
+    auto current_r = m_db.get_sha256_hmac_key(TICKET_KEY_ID);
+    if((current_r.is_ok() &&
+        m_db.insert_sha256_hmac_key(PREVIOUS_TICKET_KEY_ID, current_r.get_ok())
+            .is_err()) ||
+       m_db.insert_sha256_hmac_key(TICKET_KEY_ID, key).is_err() ||
+       m_db.set_key_rotation_time(TICKET_KEY_ID, rotated).is_err())
+    {
+        // the new key still works, it just won't outlive a restart
+        PLOG_ERROR << "DB error when storing the TLS ticket key";
+    }
+
+    use_ticket_key(key);
+    m_last_rotation = rotated;
+    PLOG_INFO << "rotated the TLS ticket key";
+}
+#endif
+
+int64_t TlsContext::get_cleanup_interval_seconds() {
+    return TICKET_CHECK_SECONDS;
+}
+
+void TlsContext::perform_cleanup() {
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    // cleanups also run right away when the server starts, at which point the
+    // key has just been checked (or replaced) already
+    if(now<seconds>() - m_last_rotation >= TICKET_ROTATION_SECONDS) {
+        rotate_ticket_key();
+    }
+#endif
+}
+
+// mongoose TLS hooks
+// these mirror mongoose's own mbedTLS glue, except that the config comes from
+// the shared TlsContext instead of being rebuilt for every connection.
+
+struct TlsConnection {
+    mbedtls_ssl_context ssl;
+};
+
+static int net_send(void *ctx, const unsigned char *buf, size_t len) {
+    long n = mg_io_send((mg_connection *)ctx, buf, len);
+    if(n == MG_IO_WAIT) {
+        return MBEDTLS_ERR_SSL_WANT_WRITE;
+    } else if(n == MG_IO_RESET) {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    } else if(n == MG_IO_ERR) {
+        return MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return (int)n;
+}
+
+static int net_recv(void *ctx, unsigned char *buf, size_t len) {
+    long n = mg_io_recv((mg_connection *)ctx, buf, len);
+    if(n == MG_IO_WAIT) {
+        return MBEDTLS_ERR_SSL_WANT_READ;
+    } else if(n == MG_IO_RESET) {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    } else if(n == MG_IO_ERR) {
+        return MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    return (int)n;
+}
+
+extern "C" void mg_tls_ctx_init(mg_mgr *mgr) {
+    // set by the server once the manager is initialized
+    mgr->tls_ctx = nullptr;
+}
+
+extern "C" void mg_tls_ctx_free(mg_mgr *mgr) {
+    // owned by the server
+    mgr->tls_ctx = nullptr;
+}
+
+extern "C" void mg_tls_init(mg_connection *c, const mg_tls_opts *) {
+    const TlsContext *ctx = (const TlsContext *)c->mgr->tls_ctx;
+    if(nullptr == ctx) {
+        mg_error(c, "no TLS context");
+        return;
+    }
+    if(c->is_listening) {
+        return;
+    }
+
+    TlsConnection *tls = new TlsConnection{};
+    mbedtls_ssl_init(&tls->ssl);
+    int ret = mbedtls_ssl_setup(&tls->ssl, ctx->get_config());
+    if(0 != ret) {
+        mbedtls_ssl_free(&tls->ssl);
+        delete tls;
+        mg_error(c, "TLS setup error -%#x", -ret);
+        return;
+    }
+    mbedtls_ssl_set_bio(&tls->ssl, c, net_send, net_recv, nullptr);
+
+    c->tls = tls;
+    c->is_tls = 1;
+    c->is_tls_hs = 1;
+}
+
+extern "C" void mg_tls_free(mg_connection *c) {
+    TlsConnection *tls = (TlsConnection *)c->tls;
+    if(nullptr != tls) {
+        mbedtls_ssl_free(&tls->ssl);
+        delete tls;
+        c->tls = nullptr;
+    }
+}
+
+extern "C" void mg_tls_handshake(mg_connection *c) {
+    TlsConnection *tls = (TlsConnection *)c->tls;
+    int ret = mbedtls_ssl_handshake(&tls->ssl);
+    if(0 == ret) {
+        c->is_tls_hs = 0;
+        mg_call(c, MG_EV_TLS_HS, nullptr);
+    } else if(ret != MBEDTLS_ERR_SSL_WANT_READ &&
+              ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+        mg_error(c, "TLS handshake: -%#x", -ret);
+    }
+}
+
+extern "C" size_t mg_tls_pending(mg_connection *c) {
+    TlsConnection *tls = (TlsConnection *)c->tls;
+    return nullptr == tls ? 0 : mbedtls_ssl_get_bytes_avail(&tls->ssl);
+}
+
+extern "C" long mg_tls_recv(mg_connection *c, void *buf, size_t len) {
+    TlsConnection *tls = (TlsConnection *)c->tls;
+    long n = mbedtls_ssl_read(&tls->ssl, (unsigned char *)buf, len);
+    if(n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE ||
+       n == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+    {
+        return MG_IO_WAIT;
+    }
+    if(n <= 0) {
+        return MG_IO_ERR;
+    }
+    return n;
+}
+
+extern "C" long mg_tls_send(mg_connection *c, const void *buf, size_t len) {
+    TlsConnection *tls = (TlsConnection *)c->tls;
+    long n = mbedtls_ssl_write(&tls->ssl, (const unsigned char *)buf, len);
+    if(n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return MG_IO_WAIT;
+    }
+    if(n <= 0) {
+        return MG_IO_ERR;
+    }
+    return n;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "authconst.hpp"
+#include "db.hpp"
+#include "ratelimit.hpp"
+
+#include <mbedtls/pk.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+#include <mbedtls/x509_crt.h>
+
+#include <cstdint>
+#include <string>
+
+/// Everything about the server's TLS setup that doesn't change between
+/// connections: the parsed certificate chain and private key, and the SSL
+/// config that refers to them. It's built once and then shared by all of the
+/// connections of all of the event loops, which only need to set up their own
+/// SSL context on top of it.
+///
+/// mongoose is built with MG_TLS_CUSTOM, and its TLS hooks (in tls.cpp) find
+/// this through mg_mgr::tls_ctx.
+///
+/// Returning clients can resume their sessions instead of doing a full
+/// handshake, either with a session ticket or (for TLS 1.2 clients that don't
+/// do tickets) through a session ID cache. The ticket keys are kept in the
+/// database along with when they were made, so tickets survive restarts
+/// without the key outliving its rotation schedule.
+class TlsContext : public ICleanup {
+  private:
+    const Database &m_db;
+    mbedtls_x509_crt m_cert{};
+    mbedtls_pk_context m_key{};
+    mbedtls_ssl_config m_conf{};
+    mbedtls_ssl_cache_context m_session_cache{};
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_ticket_context m_tickets{};
+    int64_t m_last_rotation{};
+
+    void use_ticket_key(const mac_key_t &key);
+    void rotate_ticket_key();
+#endif
+
+  public:
+    TlsContext() = delete;
+    TlsContext(const TlsContext &) = delete;
+    TlsContext(TlsContext &&) = delete;
+    /// Takes the PEM-encoded private key and certificate chain. Exits if
+    /// either of them can't be parsed.
+    TlsContext(const Database &db, const std::string &key,
+               const std::string &cert);
+    ~TlsContext();
+
+    int64_t get_cleanup_interval_seconds() override;
+    void perform_cleanup() override;
+
+    inline const mbedtls_ssl_config *get_config() const {
+        return &m_conf;
+    }
+};
\ No newline at end of file
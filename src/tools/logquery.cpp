@@ -0,0 +1,246 @@
+// Summarizes binary access logs: request counts, status codes and latency
+// percentiles per route, optionally limited to a time range.
+//
+//     andromeda-logquery [--from TIME] [--to TIME] FILE...
+//
+// TIME is either a unix timestamp or a UTC date like 2024-05-01 or
+// 2024-05-01T13:30:00. The files are read one record at a time, so they can be
+// as large as they like.
+
+#include "../accesslog_format.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+using std::string, std::vector, std::optional;
+
+// Histogram
+
+// latencies are bucketed with 16 buckets per power of two, which keeps
+// percentiles within about 6% while taking a fixed amount of memory
+constexpr int SUB_BUCKET_BITS = 4;
+constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+constexpr int BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+static int bucket_of(uint64_t value) {
+    if(value < SUB_BUCKETS) {
+        return (int)value;
+    }
+    int exponent = std::bit_width(value) - 1;
+    int shift = exponent - SUB_BUCKET_BITS;
+    int sub = (int)((value >> shift) & (SUB_BUCKETS - 1));
+    return SUB_BUCKETS + shift * SUB_BUCKETS + sub;
+}
+
+// the smallest value that falls into the bucket
+static uint64_t bucket_value(int bucket) {
+    if(bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    int sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return (uint64_t)(SUB_BUCKETS + sub) << shift;
+}
+
+struct Histogram {
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t total{0};
+    uint64_t max{0};
+
+    void add(uint64_t value) {
+        counts[bucket_of(value)] += 1;
+        total += 1;
+        max = std::max(max, value);
+    }
+
+    uint64_t percentile(double p) const {
+        uint64_t wanted = (uint64_t)std::ceil(p * total);
+        wanted = std::max(wanted, (uint64_t)1);
+        uint64_t seen = 0;
+        for(int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if(seen >= wanted) {
+                return std::min(bucket_value(i), max);
+            }
+        }
+        return max;
+    }
+};
+
+// Summary
+
+struct RouteStats {
+    uint64_t requests{0};
+    std::map<int, uint64_t> statuses{};
+    Histogram latency{};
+};
+
+static string format_millis(uint64_t micros) {
+    char buf[32]{};
+    snprintf(buf, sizeof(buf), "%.3fms", micros / 1000.0);
+    return buf;
+}
+
+static void print_stats(const string &route, const RouteStats &stats) {
+    std::cout << route << "\n  requests: " << stats.requests
+              << "\n  statuses:";
+    for(const auto &[status, count] : stats.statuses) {
+        std::cout << " " << status << "=" << count;
+    }
+    const Histogram &latency = stats.latency;
+    std::cout << "\n  latency: p50 " << format_millis(latency.percentile(0.5))
+              << ", p90 " << format_millis(latency.percentile(0.9))
+              << ", p99 " << format_millis(latency.percentile(0.99))
+              << ", max " << format_millis(latency.max) << "\n";
+}
+
+// Reading
+
+// returns false if the file couldn't be read at all
+static bool read_file(const char *filename, int64_t from, int64_t to,
+                      std::map<string, RouteStats> &routes) {
+    std::FILE *file = std::fopen(filename, "rb");
+    if(nullptr == file) {
+        std::cerr << filename << ": could not open the file\n";
+        return false;
+    }
+
+    char magic[sizeof(ACCESS_LOG_MAGIC)]{};
+    if(std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+       std::memcmp(magic, ACCESS_LOG_MAGIC, sizeof(magic)) != 0)
+    {
+        std::cerr << filename << ": not a binary access log\n";
+        std::fclose(file);
+        return false;
+    }
+
+    // big enough for the longest record the format allows
+    char payload[4 * UINT8_MAX + 8];
+    BinaryRecordHeader header{};
+    while(std::fread(&header, sizeof(header), 1, file) == 1) {
+        if(header.size != binary_record_size(header)) {
+            std::cerr << filename << ": corrupt record; skipping the rest\n";
+            break;
+        }
+        size_t payload_size = header.size - sizeof(header);
+        if(std::fread(payload, 1, payload_size, file) != payload_size) {
+            // the server may still be writing this one
+            break;
+        }
+        if(header.timestamp < from || header.timestamp >= to) {
+            continue;
+        }
+
+        string route(payload + header.method_len, header.route_len);
+        if(route.empty()) {
+            route = string(payload, header.method_len) + " (no route)";
+        }
+        RouteStats &stats = routes[route];
+        stats.requests += 1;
+        stats.statuses[header.status_code] += 1;
+        int64_t latency = header.latency_micros;
+        stats.latency.add(latency > 0 ? latency : 0);
+    }
+
+    std::fclose(file);
+    return true;
+}
+
+// returns milliseconds since the epoch
+static optional<int64_t> parse_time(const string &str) {
+    if(!str.empty() && std::all_of(str.begin(), str.end(), [](char c) {
+           return isdigit((unsigned char)c);
+       }))
+    {
+        int64_t secs{};
+        auto res = std::from_chars(str.data(), str.data() + str.size(), secs);
+        // the timestamp has to fit in milliseconds, too
+        if(res.ec != std::errc{} || secs > INT64_MAX / 1000) {
+            return {};
+        }
+        return secs * 1000;
+    }
+
+    std::tm tm{};
+    int matched = sscanf(str.c_str(), "%d-%d-%dT%d:%d:%d", &tm.tm_year,
+                         &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+                         &tm.tm_sec);
+    if(matched != 3 && matched < 5) {
+        return {};
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return (int64_t)timegm(&tm) * 1000;
+}
+
+static int usage() {
+    std::cerr << "usage: andromeda-logquery [--from TIME] [--to TIME] FILE...\n"
+                 "TIME is a unix timestamp or a UTC date "
+                 "(2024-05-01, 2024-05-01T13:30:00)\n";
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    int64_t from = INT64_MIN, to = INT64_MAX;
+    vector<const char *> files{};
+
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--from" || arg == "--to") {
+            if(i + 1 == argc) {
+                return usage();
+            }
+            auto time = parse_time(argv[++i]);
+            if(!time.has_value()) {
+                std::cerr << "bad time: " << argv[i] << "\n";
+                return usage();
+            }
+            (arg == "--from" ? from : to) = *time;
+        } else if(arg.starts_with("-")) {
+            return usage();
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if(files.empty()) {
+        return usage();
+    }
+
+    std::map<string, RouteStats> routes{};
+    bool ok = true;
+    for(const char *filename : files) {
+        ok = read_file(filename, from, to, routes) && ok;
+    }
+
+    RouteStats total{};
+    for(const auto &[route, stats] : routes) {
+        print_stats(route, stats);
+        total.requests += stats.requests;
+        for(const auto &[status, count] : stats.statuses) {
+            total.statuses[status] += count;
+        }
+        for(int i = 0; i < BUCKETS; i++) {
+            total.latency.counts[i] += stats.latency.counts[i];
+        }
+        total.latency.total += stats.latency.total;
+        total.latency.max = std::max(total.latency.max, stats.latency.max);
+    }
+    if(routes.size() != 1) {
+        print_stats("total", total);
+    }
+
+    return ok ? 0 : 1;
+}
\ No newline at end of file
@@ -5,12 +5,11 @@
 #include <algorithm>
 #include <cstring>
 #include <fstream>
-#include <optional>
 #include <sstream>
 #include <variant>
 
 using std::string, std::ifstream, std::stringstream, std::monostate,
-    std::vector, std::optional;
+    std::string_view;
 
 Result<string, monostate> read_file(const string &filename) {
     ifstream file(filename);
@@ -22,17 +21,6 @@ Result<string, monostate> read_file(const string &filename) {
     return {buffer.str(), Ok};
 }
 
-Result<string, monostate> percent_decode(const string &input, bool form) {
-    string buf(input.size() + 1, '\0');
-    int len =
-        mg_url_decode(input.data(), input.size(), buf.data(), buf.size(), form);
-    if(len < 0) {
-        return {monostate{}, Err};
-    }
-    buf.resize(len);
-    return {buf, Ok};
-}
-
 bool is_valid_username(const std::string &username) {
     if(username.size() < 1 || username.size() > 40) {
         return false;
@@ -79,54 +67,44 @@ void trim(string &s) {
     rtrim(s);
 }
 
-/// https://mongoose.ws/documentation/#mg_match
-/// Uses the same wildcards, except:
-/// If there's no match, nullopt is returned.
-/// If there is a match, a vector of all the captures is returned.
-template <>
-optional<vector<string>> match<true>(const string &input,
-                                     const string &pattern) {
-    size_t wildcards = 0;
-    for(char ch : pattern) {
-        if(ch == '?' || ch == '*' || ch == '#') {
-            wildcards += 1;
-        }
-    }
-
-    vector<mg_str> captures(wildcards + 1, mg_str{});
-    bool ret =
-        mg_match(mg_str_n(input.data(), input.size()),
-                 mg_str_n(pattern.data(), pattern.size()), captures.data());
-    if(!ret) {
-        return std::nullopt;
-    } else {
-        captures.pop_back();
-        vector<string> new_captures{};
-        for(mg_str str : captures) {
-            new_captures.push_back(string(str.buf, str.len));
-        }
-        return new_captures;
-    }
+string mg_ip_to_string(mg_addr addr) {
+    char buf[50]{}; // longer than any possible IP
+    mg_snprintf(buf, sizeof(buf), "%M", mg_print_ip, &addr);
+    return string(buf);
 }
 
-/// https://mongoose.ws/documentation/#mg_match
-/// Uses the same wildcards, except:
-/// If there's no match, nullopt is returned.
-/// If there is a match, an empty vector is returned.
-template <>
-optional<vector<string>> match<false>(const string &input,
-                                      const string &pattern) {
-    bool ret = mg_match(mg_str_n(input.data(), input.size()),
-                        mg_str_n(pattern.data(), pattern.size()), nullptr);
-    if(!ret) {
-        return std::nullopt;
+// returns the length of the UTF-8 sequence at the start of `str`, or 0 if it
+// isn't a valid one
+size_t utf8_sequence_length(string_view str) {
+    unsigned char lead = str[0];
+    size_t len{};
+    uint32_t min{};
+    uint32_t cp{};
+    if(lead < 0x80) {
+        return 1;
+    } else if((lead & 0xe0) == 0xc0) {
+        len = 2, min = 0x80, cp = lead & 0x1f;
+    } else if((lead & 0xf0) == 0xe0) {
+        len = 3, min = 0x800, cp = lead & 0x0f;
+    } else if((lead & 0xf8) == 0xf0) {
+        len = 4, min = 0x10000, cp = lead & 0x07;
     } else {
-        return vector<string>{};
+        return 0;
     }
-}
 
-string mg_ip_to_string(mg_addr addr) {
-    char buf[50]{}; // longer than any possible IP
-    mg_snprintf(buf, sizeof(buf), "%M", mg_print_ip, &addr);
-    return string(buf);
+    if(str.size() < len) {
+        return 0;
+    }
+    for(size_t i = 1; i < len; i++) {
+        unsigned char ch = str[i];
+        if((ch & 0xc0) != 0x80) {
+            return 0;
+        }
+        cp = (cp << 6) | (ch & 0x3f);
+    }
+    // overlong encodings, surrogates and anything past the last code point
+    if(cp < min || (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) {
+        return 0;
+    }
+    return len;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <chrono>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -49,19 +50,14 @@ template <typename T, typename E> class Result {
 
 Result<std::string, std::monostate> read_file(const std::string &filename);
 
-Result<std::string, std::monostate> percent_decode(const std::string &input,
-                                                   bool form);
-
 bool is_valid_username(const std::string &username);
 bool is_valid_password(const std::string &password);
 bool is_localhost(mg_addr addr);
 void ltrim(std::string &s);
 void rtrim(std::string &s);
 void trim(std::string &s);
-template <bool capture>
-std::optional<std::vector<std::string>> match(const std::string &input,
-                                              const std::string &pattern);
 std::string mg_ip_to_string(mg_addr addr);
+size_t utf8_sequence_length(std::string_view str);
 template <typename unit> inline int64_t now() {
     return std::chrono::duration_cast<unit>(
                std::chrono::system_clock::now().time_since_epoch())
@@ -0,0 +1,137 @@
+#include "visitors.hpp"
+#include "util.hpp"
+
+#include <plog/Log.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <variant>
+#include <vector>
+
+using std::vector, std::monostate;
+
+constexpr int64_t MILLIS_PER_DAY = 24 * 60 * 60 * 1000;
+
+static int64_t current_day() {
+    return now<std::chrono::milliseconds>() / MILLIS_PER_DAY;
+}
+
+static void log_error(const DbResult<monostate> &res) {
+    if(res.is_err()) {
+        PLOG_ERROR << "DB error when storing visitor statistics";
+    }
+}
+
+VisitorCounter::VisitorCounter(const Database &db, AsyncDatabase &async_db,
+                               int64_t max_unflushed)
+    : m_db{db}, m_async_db{async_db}, m_max_unflushed{max_unflushed},
+      m_day{current_day()} {
+    auto visitors_r = m_db.get_visitors();
+    if(visitors_r.is_err()) {
+        PLOG_FATAL << "could not load the visitor count";
+        exit(1);
+    }
+    m_count = visitors_r.get_ok();
+    m_flushed = m_count.load();
+
+    load_sketch(m_day, m_today);
+    load_sketch(ALL_TIME_SKETCH, m_all_time);
+    m_unique_today = m_today.estimate();
+    m_unique_all_time = m_all_time.estimate();
+}
+
+void VisitorCounter::load_sketch(int64_t day, HyperLogLog &sketch) {
+    auto sketch_r = m_db.get_visitor_sketch(day);
+    if(sketch_r.is_err()) {
+        if(sketch_r.get_err() != DbError::Nonexistent) {
+            PLOG_FATAL << "could not load the unique visitor sketches";
+            exit(1);
+        }
+    } else if(!sketch.load(sketch_r.get_ok())) {
+        PLOG_WARNING << "ignoring a stored visitor sketch of the wrong size";
+    }
+}
+
+void VisitorCounter::flush_async(int64_t count) {
+    m_async_db.set_visitors(count, log_error);
+}
+
+void VisitorCounter::store_sketches_async() {
+    if(!m_sketches_dirty) {
+        return;
+    }
+    auto today = m_today.data(), all_time = m_all_time.data();
+    m_async_db.set_visitor_sketch(
+        m_day, vector<uint8_t>(today.begin(), today.end()), log_error);
+    m_async_db.set_visitor_sketch(
+        ALL_TIME_SKETCH, vector<uint8_t>(all_time.begin(), all_time.end()),
+        log_error);
+    m_sketches_dirty = false;
+}
+
+void VisitorCounter::roll_over(int64_t day) {
+    store_sketches_async();
+    m_today.clear();
+    m_day = day;
+    m_unique_today = 0;
+}
+
+VisitorCounter::Visit VisitorCounter::visit(std::string_view visitor) {
+    int64_t count = ++m_count;
+    int64_t flushed = m_flushed;
+    // only the thread that moves m_flushed forward gets to flush, so a burst
+    // of visits doesn't turn into a burst of writes
+    if(count - flushed >= m_max_unflushed &&
+       m_flushed.compare_exchange_strong(flushed, count))
+    {
+        flush_async(count);
+    }
+
+    std::lock_guard lock{m_sketch_mutex};
+    int64_t day = current_day();
+    if(day != m_day) {
+        roll_over(day);
+    }
+    if(m_today.add(visitor)) {
+        m_unique_today = m_today.estimate();
+        m_sketches_dirty = true;
+    }
+    if(m_all_time.add(visitor)) {
+        m_unique_all_time = m_all_time.estimate();
+        m_sketches_dirty = true;
+    }
+    return {count, m_unique_today, m_unique_all_time};
+}
+
+void VisitorCounter::flush() {
+    int64_t count = m_count;
+    if(m_db.set_visitors(count).is_ok()) {
+        m_flushed = count;
+        PLOG_INFO << "stored the visitor count (" << count << ")";
+    } else {
+        PLOG_ERROR << "could not store the visitor count (" << count << ")";
+    }
+
+    std::lock_guard lock{m_sketch_mutex};
+    if(m_sketches_dirty &&
+       (m_db.set_visitor_sketch(m_day, m_today.data()).is_err() ||
+        m_db.set_visitor_sketch(ALL_TIME_SKETCH, m_all_time.data()).is_err()))
+    {
+        PLOG_ERROR << "could not store the unique visitor sketches";
+    }
+    m_sketches_dirty = false;
+}
+
+int64_t VisitorCounter::get_cleanup_interval_seconds() {
+    return 10;
+}
+
+void VisitorCounter::perform_cleanup() {
+    int64_t count = m_count;
+    if(m_flushed.exchange(count) != count) {
+        flush_async(count);
+    }
+
+    std::lock_guard lock{m_sketch_mutex};
+    store_sketches_async();
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "asyncdb.hpp"
+#include "db.hpp"
+#include "hyperloglog.hpp"
+#include "ratelimit.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+
+/// Counts visits in memory, so that the home page doesn't have to write to the
+/// database. The count is loaded once, and written back through the database
+/// thread every so often: as soon as `max_unflushed` visits have piled up, and
+/// on every cleanup otherwise. A crash loses at most about `max_unflushed`
+/// visits, or however many came in since the last cleanup if that's fewer.
+/// flush() writes it back for good on shutdown.
+///
+/// Unique visitors are estimated with a sketch for the current (UTC) day and
+/// one for all time, which are stored on every cleanup and on flush().
+class VisitorCounter : public ICleanup {
+  public:
+    struct Visit {
+        int64_t visitors;
+        uint64_t unique_today;
+        uint64_t unique_all_time;
+    };
+
+  private:
+    const Database &m_db;
+    AsyncDatabase &m_async_db;
+    int64_t m_max_unflushed;
+    std::atomic<int64_t> m_count;
+    // what has been handed to the database thread so far
+    std::atomic<int64_t> m_flushed;
+
+    std::mutex m_sketch_mutex{};
+    HyperLogLog m_today{};
+    HyperLogLog m_all_time{};
+    // the day that m_today is for, in days since the epoch
+    int64_t m_day;
+    // the estimates only change when the sketches do, so they're kept around
+    uint64_t m_unique_today{0};
+    uint64_t m_unique_all_time{0};
+    bool m_sketches_dirty{false};
+
+    void flush_async(int64_t count);
+    void load_sketch(int64_t day, HyperLogLog &sketch);
+    // these must be called with m_sketch_mutex held
+    void store_sketches_async();
+    void roll_over(int64_t day);
+
+  public:
+    VisitorCounter(const Database &db, AsyncDatabase &async_db,
+                   int64_t max_unflushed);
+
+    /// Counts a visit from `visitor`, which is anything that tells visitors
+    /// apart (an address, a username...), and returns the new numbers.
+    Visit visit(std::string_view visitor);
+    /// Writes the count and the sketches to the database right away. This is
+    /// meant for after the database thread has been stopped.
+    void flush();
+
+    int64_t get_cleanup_interval_seconds() override;
+    void perform_cleanup() override;
+};
\ No newline at end of file